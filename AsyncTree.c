@@ -0,0 +1,245 @@
+#include "AsyncTree.h"
+#include "Node.h"
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+// Maksymalna liczba żądań, które wątek roboczy bierze z kolejki naraz.
+#define QUEUE_BATCH 32
+
+struct TreeQueue {
+    Tree *tree;
+    pthread_t *workers;
+    size_t n_workers;
+    // Chroni kolejkę zgłoszeń, in_flight i stop
+    pthread_mutex_t mutex;
+    // Na tej zmiennej wątki robocze czekają na zgłoszenia
+    pthread_cond_t nonempty;
+    // Kolejki cykliczne zgłoszeń i zakończeń, obie o rozmiarze capacity
+    TreeRequest *sq;
+    size_t sq_head, sq_size;
+    // Chroni kolejkę zakończeń
+    pthread_mutex_t cq_mutex;
+    TreeCompletion *cq;
+    size_t cq_head, cq_size;
+    size_t capacity;
+    // Liczba zgłoszonych, a jeszcze nieodebranych żądań. Nie przekracza
+    // capacity, więc w kolejce zakończeń zawsze jest miejsce.
+    size_t in_flight;
+    bool stop;
+    int event_fd;
+};
+
+// Żądanie wzięte przez wątek roboczy.
+typedef struct Pending {
+    TreeRequest request;
+    // Ścieżka do rodzica, jeśli operację można wykonać w paczce z innymi
+    // operacjami na tym samym rodzicu, a NULL wpp
+    char *parent;
+    char name[MAX_FOLDER_NAME_LENGTH + 1];
+    TreeCompletion completion;
+} Pending;
+
+static void run_single(Tree *tree, Pending *p) {
+    const TreeRequest *r = &p->request;
+    p->completion.list = NULL;
+    switch (r->type) {
+        case TREE_CREATE:
+            p->completion.result = tree_create(tree, r->path);
+            break;
+        case TREE_REMOVE:
+            p->completion.result = tree_remove(tree, r->path);
+            break;
+        case TREE_MOVE:
+            p->completion.result = tree_move(tree, r->path, r->target);
+            break;
+        case TREE_LIST:
+            if (!is_path_valid(r->path)) {
+                p->completion.result = EINVAL;
+                break;
+            }
+            p->completion.list = tree_list(tree, r->path);
+            p->completion.result = p->completion.list ? 0 : ENOENT;
+            break;
+        default:
+            p->completion.result = EINVAL;
+    }
+}
+
+// Wykonuje paczkę żądań. Tworzenie i usuwanie dzieci tego samego folderu
+// grupujemy i wykonujemy pod jednym writelockiem (zachowując ich kolejność),
+// zamiast przechodzić protokół wstępny osobno dla każdej z nich. Grupy
+// wykonujemy w porządku ścieżek rodziców, po pozostałych żądaniach, więc
+// żądania z różnych grup nie zachowują kolejności zgłoszeń.
+static void run_batch(Tree *tree, Pending *batch, size_t n) {
+    size_t order[QUEUE_BATCH], n_grouped = 0;
+    for (size_t i = 0; i < n; i++) {
+        Pending *p = &batch[i];
+        p->completion.user_data = p->request.user_data;
+        p->parent = NULL;
+        if ((p->request.type == TREE_CREATE ||
+             p->request.type == TREE_REMOVE) &&
+            is_path_valid(p->request.path) &&
+            strcmp(p->request.path, "/") != 0)
+            p->parent = make_path_to_parent(p->request.path, p->name);
+        if (p->parent == NULL) {
+            run_single(tree, p);
+            continue;
+        }
+        // Sortowanie przez wstawianie, stabilne względem kolejności zgłoszeń
+        size_t j = n_grouped++;
+        while (j > 0 && strcmp(batch[order[j - 1]].parent, p->parent) > 0) {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = i;
+    }
+    TreeOpType types[QUEUE_BATCH];
+    const char *names[QUEUE_BATCH];
+    int results[QUEUE_BATCH];
+    for (size_t start = 0, end; start < n_grouped; start = end) {
+        const char *parent = batch[order[start]].parent;
+        for (end = start; end < n_grouped &&
+                          strcmp(batch[order[end]].parent, parent) == 0; end++) {
+            types[end - start] = batch[order[end]].request.type;
+            names[end - start] = batch[order[end]].name;
+        }
+        tree_batch(tree, parent, types, names, end - start, results);
+        for (size_t k = start; k < end; k++) {
+            batch[order[k]].completion.result = results[k - start];
+            batch[order[k]].completion.list = NULL;
+        }
+    }
+    for (size_t k = 0; k < n_grouped; k++)
+        free(batch[order[k]].parent);
+}
+
+static void post_completions(TreeQueue *q, Pending *batch, size_t n) {
+    ptry(pthread_mutex_lock(&q->cq_mutex));
+    for (size_t i = 0; i < n; i++) {
+        q->cq[(q->cq_head + q->cq_size) % q->capacity] = batch[i].completion;
+        q->cq_size++;
+    }
+    ptry(pthread_mutex_unlock(&q->cq_mutex));
+    uint64_t count = n;
+    if (write(q->event_fd, &count, sizeof(count)) != sizeof(count))
+        syserr("Error in write to eventfd");
+}
+
+static void *worker(void *data) {
+    TreeQueue *q = data;
+    Pending batch[QUEUE_BATCH];
+    while (true) {
+        ptry(pthread_mutex_lock(&q->mutex));
+        while (q->sq_size == 0 && !q->stop)
+            ptry(pthread_cond_wait(&q->nonempty, &q->mutex));
+        if (q->sq_size == 0) {
+            ptry(pthread_mutex_unlock(&q->mutex));
+            return NULL;
+        }
+        // Bierzemy swoją część zgłoszeń, żeby pozostałe wątki też
+        // miały co robić, ale w paczkach, żeby było co grupować.
+        size_t n = (q->sq_size + q->n_workers - 1) / q->n_workers;
+        if (n > QUEUE_BATCH)
+            n = QUEUE_BATCH;
+        for (size_t i = 0; i < n; i++) {
+            batch[i].request = q->sq[q->sq_head];
+            q->sq_head = (q->sq_head + 1) % q->capacity;
+        }
+        q->sq_size -= n;
+        ptry(pthread_mutex_unlock(&q->mutex));
+        run_batch(q->tree, batch, n);
+        post_completions(q, batch, n);
+    }
+}
+
+TreeQueue *tree_queue_new(Tree *tree, size_t workers, size_t capacity) {
+    if (workers == 0 || capacity == 0)
+        fatal("Tree queue needs at least one worker and one slot");
+    TreeQueue *q = malloc(sizeof(TreeQueue));
+    if (q == NULL)
+        fatal("Memory allocation failed");
+    q->tree = tree;
+    q->n_workers = workers;
+    q->capacity = capacity;
+    q->sq_head = q->sq_size = q->cq_head = q->cq_size = 0;
+    q->in_flight = 0;
+    q->stop = false;
+    q->sq = malloc(capacity * sizeof(TreeRequest));
+    q->cq = malloc(capacity * sizeof(TreeCompletion));
+    q->workers = malloc(workers * sizeof(pthread_t));
+    if (q->sq == NULL || q->cq == NULL || q->workers == NULL)
+        fatal("Memory allocation failed");
+    if ((q->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+        syserr("Error in eventfd");
+    ptry(pthread_mutex_init(&q->mutex, 0));
+    ptry(pthread_mutex_init(&q->cq_mutex, 0));
+    ptry(pthread_cond_init(&q->nonempty, 0));
+    for (size_t i = 0; i < workers; i++)
+        ptry(pthread_create(&q->workers[i], 0, worker, q));
+    return q;
+}
+
+void tree_queue_free(TreeQueue *q) {
+    ptry(pthread_mutex_lock(&q->mutex));
+    q->stop = true;
+    ptry(pthread_cond_broadcast(&q->nonempty));
+    ptry(pthread_mutex_unlock(&q->mutex));
+    for (size_t i = 0; i < q->n_workers; i++)
+        ptry(pthread_join(q->workers[i], NULL));
+    for (size_t i = 0; i < q->cq_size; i++)
+        free(q->cq[(q->cq_head + i) % q->capacity].list);
+    close(q->event_fd);
+    ptry(pthread_cond_destroy(&q->nonempty));
+    ptry(pthread_mutex_destroy(&q->cq_mutex));
+    ptry(pthread_mutex_destroy(&q->mutex));
+    free(q->workers);
+    free(q->cq);
+    free(q->sq);
+    free(q);
+}
+
+int tree_queue_fd(TreeQueue *q) {
+    return q->event_fd;
+}
+
+size_t tree_queue_submit(TreeQueue *q, const TreeRequest *requests,
+                         size_t n) {
+    ptry(pthread_mutex_lock(&q->mutex));
+    size_t accepted = q->capacity - q->in_flight;
+    if (accepted > n)
+        accepted = n;
+    for (size_t i = 0; i < accepted; i++) {
+        q->sq[(q->sq_head + q->sq_size) % q->capacity] = requests[i];
+        q->sq_size++;
+    }
+    q->in_flight += accepted;
+    if (accepted > 1) {
+        ptry(pthread_cond_broadcast(&q->nonempty));
+    } else if (accepted == 1) {
+        ptry(pthread_cond_signal(&q->nonempty));
+    }
+    ptry(pthread_mutex_unlock(&q->mutex));
+    return accepted;
+}
+
+size_t tree_queue_reap(TreeQueue *q, TreeCompletion *completions,
+                       size_t max) {
+    ptry(pthread_mutex_lock(&q->cq_mutex));
+    size_t n = q->cq_size < max ? q->cq_size : max;
+    for (size_t i = 0; i < n; i++) {
+        completions[i] = q->cq[q->cq_head];
+        q->cq_head = (q->cq_head + 1) % q->capacity;
+    }
+    q->cq_size -= n;
+    ptry(pthread_mutex_unlock(&q->cq_mutex));
+    if (n > 0) {
+        ptry(pthread_mutex_lock(&q->mutex));
+        q->in_flight -= n;
+        ptry(pthread_mutex_unlock(&q->mutex));
+    }
+    return n;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stddef.h>
+#include "Tree.h"
+
+// Asynchroniczny interfejs do drzewa: wołający wrzuca żądania do kolejki
+// zgłoszeń i nigdy nie czeka na locki drzewa, a stała pula wątków
+// roboczych je wykonuje i wrzuca wyniki do kolejki zakończeń. O nowych
+// wynikach informuje deskryptor eventfd, który można dodać do pętli zdarzeń.
+typedef struct TreeQueue TreeQueue;
+
+// Żądanie wykonania operacji. Napisy path i target muszą pozostać ważne,
+// dopóki nie odbierze się wyniku żądania.
+typedef struct TreeRequest {
+    TreeOpType type;
+    const char *path;
+    // Docelowa ścieżka dla TREE_MOVE, w pozostałych przypadkach ignorowana
+    const char *target;
+    void *user_data;
+} TreeRequest;
+
+// Wynik żądania.
+typedef struct TreeCompletion {
+    void *user_data;
+    // To, co zwróciłaby odpowiednia funkcja z Tree.h (dla TREE_LIST 0,
+    // jeśli folder istnieje, a ENOENT wpp)
+    int result;
+    // Wynik tree_list, który wołający musi zwolnić (NULL dla innych operacji)
+    char *list;
+} TreeCompletion;
+
+// Tworzy kolejkę obsługiwaną przez `workers` wątków, w której jednocześnie
+// może być co najwyżej `capacity` nieodebranych żądań.
+TreeQueue *tree_queue_new(Tree *tree, size_t workers, size_t capacity);
+
+// Czeka na wykonanie wszystkich zgłoszonych żądań, kończy wątki robocze
+// i zwalnia kolejkę razem z nieodebranymi wynikami.
+void tree_queue_free(TreeQueue *queue);
+
+// Zwraca deskryptor eventfd, który jest gotowy do czytania, gdy w kolejce
+// są wyniki do odebrania. Odczyt z niego zeruje licznik powiadomień.
+int tree_queue_fd(TreeQueue *queue);
+
+// Zgłasza co najwyżej n żądań, nie blokując się na lockach drzewa.
+// Zwraca liczbę przyjętych żądań (mniej niż n, gdy kolejka jest pełna).
+// Żądania zgłoszone jednocześnie mogą się wykonać w dowolnej kolejności,
+// także wzięte przez jeden wątek roboczy w jednej paczce: tworzenie
+// i usuwanie wykonuje on pogrupowane według rodzica, w porządku ścieżek
+// rodziców, a pozostałe żądania przed nimi. Na przykład zgłoszone razem
+// TREE_REMOVE /a/b/ i TREE_REMOVE /a/ mogą dać ENOTEMPTY dla /a/. Żeby
+// uporządkować zależne żądania, trzeba poczekać na wynik wcześniejszego.
+size_t tree_queue_submit(TreeQueue *queue, const TreeRequest *requests,
+                         size_t n);
+
+// Odbiera co najwyżej max wyników bez czekania i zwraca ich liczbę.
+size_t tree_queue_reap(TreeQueue *queue, TreeCompletion *completions,
+                       size_t max);
@@ -0,0 +1,329 @@
+#include "Children.h"
+#include "err.h"
+#include "path_utils.h"
+#include <malloc.h>
+#include <stdlib.h>
+#include <string.h>
+
+void children_init(Children *children) {
+    children->size = 0;
+    children->kind = CHILDREN_ONE;
+}
+
+// Zwraca posortowaną tablicę dzieci (jeśli nie są w hashmapie).
+static ChildrenEntry *entries(Children *children) {
+    return children->kind == CHILDREN_ONE ? &children->one : children->small;
+}
+
+static ChildrenEntry *small_new(void) {
+    ChildrenEntry *small = malloc(CHILDREN_SMALL * sizeof(ChildrenEntry));
+    if (small == NULL)
+        fatal("Memory allocation failed");
+    return small;
+}
+
+void children_free(Children *children) {
+    if (children->kind == CHILDREN_MAP) {
+        nmap_free(children->map);
+    } else {
+        ChildrenEntry *small = entries(children);
+        for (size_t i = 0; i < children->size; i++)
+            name_release(small[i].key);
+        if (children->kind == CHILDREN_ARRAY)
+            free(small);
+    }
+    children_init(children);
+}
+
+void children_copy(Children *dst, Children *src) {
+    dst->size = src->size;
+    dst->kind = src->kind;
+    if (src->kind != CHILDREN_MAP) {
+        if (src->kind == CHILDREN_ARRAY)
+            dst->small = small_new();
+        ChildrenEntry *from = entries(src), *to = entries(dst);
+        for (size_t i = 0; i < src->size; i++) {
+            to[i].key = name_copy(from[i].key);
+            to[i].value = from[i].value;
+        }
+        return;
+    }
+    if ((dst->map = nmap_new()) == NULL)
+        fatal("Memory allocation failed");
+    Name key;
+    void *value;
+    NameMapIterator it = nmap_iterator(src->map);
+    while (nmap_next(src->map, &it, &key, &value))
+        nmap_insert(dst->map, key, value);
+}
+
+// Zwraca pozycję, na której jest lub powinien być klucz w tablicy dzieci,
+// a przez `found` informuje, czy tam jest.
+static size_t small_find(Children *children, Name key, bool *found) {
+    ChildrenEntry *small = entries(children);
+    size_t i = 0;
+    int cmp = 1;
+    while (i < children->size && (cmp = name_compare(small[i].key, key)) < 0)
+        i++;
+    *found = i < children->size && cmp == 0;
+    return i;
+}
+
+void *children_get_name(Children *children, Name key) {
+    if (children->kind == CHILDREN_MAP)
+        return nmap_get(children->map, key);
+    // Tu wystarczy równość, a ta jest porównaniem dwóch słów.
+    ChildrenEntry *small = entries(children);
+    for (size_t i = 0; i < children->size; i++) {
+        if (name_equal(small[i].key, key))
+            return small[i].value;
+    }
+    return NULL;
+}
+
+void *children_get(Children *children, const char *key) {
+    return children_get_name(children, name_lookup(key));
+}
+
+static int compare_names(const void *a, const void *b) {
+    return name_compare(*(const Name *) a, *(const Name *) b);
+}
+
+// Zapisuje do `keys` posortowane klucze zbioru.
+static void sorted_keys(Children *children, Name *keys) {
+    if (children->kind != CHILDREN_MAP) {
+        ChildrenEntry *small = entries(children);
+        for (size_t i = 0; i < children->size; i++)
+            keys[i] = small[i].key;
+        return;
+    }
+    Name *key = keys;
+    void *value;
+    NameMapIterator it = nmap_iterator(children->map);
+    while (nmap_next(children->map, &it, key, &value))
+        key++;
+    qsort(keys, children->size, sizeof(Name), compare_names);
+}
+
+// Przenosi jedyne dziecko do nowej tablicy, żeby zrobić miejsce na kolejne.
+static void grow(Children *children) {
+    ChildrenEntry *small = small_new();
+    if (children->size > 0)
+        small[0] = children->one;
+    children->small = small;
+    children->kind = CHILDREN_ARRAY;
+}
+
+// Przenosi dzieci z tablicy do nowej hashmapy.
+static void promote(Children *children) {
+    NameMap *map = nmap_new();
+    if (map == NULL)
+        fatal("Memory allocation failed");
+    ChildrenEntry *small = children->small;
+    for (size_t i = 0; i < children->size; i++) {
+        nmap_insert(map, small[i].key, small[i].value);
+        name_release(small[i].key);
+    }
+    free(small);
+    children->map = map;
+    children->kind = CHILDREN_MAP;
+}
+
+// Przenosi dzieci z hashmapy z powrotem do tablicy.
+static void demote(Children *children) {
+    NameMap *map = children->map;
+    ChildrenEntry *small = small_new();
+    Name keys[CHILDREN_SMALL];
+    sorted_keys(children, keys);
+    for (size_t i = 0; i < children->size; i++) {
+        small[i].value = nmap_get(map, keys[i]);
+        small[i].key = name_copy(keys[i]);
+    }
+    nmap_free(map);
+    children->small = small;
+    children->kind = CHILDREN_ARRAY;
+}
+
+bool children_insert(Children *children, const char *key, void *value) {
+    if (value == NULL)
+        return false;
+    Name name = name_new(key);
+    bool inserted = false;
+    if (children->kind != CHILDREN_MAP &&
+        children_get_name(children, name) == NULL) {
+        if (children->kind == CHILDREN_ONE && children->size == 1)
+            grow(children);
+        else if (children->size == CHILDREN_SMALL)
+            promote(children);
+    }
+    if (children->kind == CHILDREN_MAP) {
+        inserted = nmap_insert(children->map, name, value);
+    } else {
+        bool found;
+        size_t i = small_find(children, name, &found);
+        if (!found) {
+            ChildrenEntry *small = entries(children);
+            memmove(&small[i + 1], &small[i],
+                    (children->size - i) * sizeof(ChildrenEntry));
+            small[i].key = name_copy(name);
+            small[i].value = value;
+            inserted = true;
+        }
+    }
+    name_release(name);
+    if (inserted)
+        children->size++;
+    return inserted;
+}
+
+bool children_remove(Children *children, const char *key) {
+    Name name = name_lookup(key);
+    bool removed = false;
+    if (children->kind == CHILDREN_MAP) {
+        removed = nmap_remove(children->map, name);
+        if (removed && --children->size <= CHILDREN_SMALL / 2)
+            demote(children);
+    } else {
+        bool found;
+        size_t i = small_find(children, name, &found);
+        if (found) {
+            ChildrenEntry *small = entries(children);
+            name_release(small[i].key);
+            children->size--;
+            memmove(&small[i], &small[i + 1],
+                    (children->size - i) * sizeof(ChildrenEntry));
+            removed = true;
+        }
+        if (children->size == 0 && children->kind == CHILDREN_ARRAY) {
+            free(children->small);
+            children->kind = CHILDREN_ONE;
+        }
+    }
+    return removed;
+}
+
+bool children_rename(Children *children, const char *key,
+                     const char *new_key) {
+    Name name = name_lookup(key);
+    Name new_name = name_new(new_key);
+    bool renamed = false;
+    if (children->kind == CHILDREN_MAP) {
+        renamed = nmap_rename(children->map, name, new_name);
+    } else {
+        bool found, exists;
+        size_t i = small_find(children, name, &found);
+        size_t j = small_find(children, new_name, &exists);
+        if (found && !exists) {
+            // Przesuwamy elementy między starą a nową pozycją o jeden,
+            // tak żeby tablica pozostała posortowana.
+            ChildrenEntry *small = entries(children);
+            void *value = small[i].value;
+            name_release(small[i].key);
+            if (j > i) {
+                j--;
+                memmove(&small[i], &small[i + 1],
+                        (j - i) * sizeof(ChildrenEntry));
+            } else {
+                memmove(&small[j + 1], &small[j],
+                        (i - j) * sizeof(ChildrenEntry));
+            }
+            small[j].key = name_copy(new_name);
+            small[j].value = value;
+            renamed = true;
+        }
+    }
+    name_release(new_name);
+    return renamed;
+}
+
+size_t children_size(Children *children) {
+    return children->size;
+}
+
+size_t children_memory(Children *children) {
+    switch (children->kind) {
+    case CHILDREN_ARRAY:
+        return malloc_usable_size(children->small);
+    case CHILDREN_MAP:
+        return nmap_memory(children->map);
+    default:
+        return 0;
+    }
+}
+
+void children_rebuild(Children *children, void *(*relocate)(void *, void *),
+                      void *arg) {
+    size_t n = children->size;
+    Name *keys = malloc(n * sizeof(Name) + 1);
+    if (keys == NULL)
+        fatal("Memory allocation failed");
+    sorted_keys(children, keys);
+    Children fresh;
+    fresh.size = n;
+    fresh.kind = n <= 1 ? CHILDREN_ONE :
+                 n <= CHILDREN_SMALL ? CHILDREN_ARRAY : CHILDREN_MAP;
+    if (fresh.kind == CHILDREN_ARRAY)
+        fresh.small = small_new();
+    if (fresh.kind == CHILDREN_MAP && (fresh.map = nmap_new()) == NULL)
+        fatal("Memory allocation failed");
+    for (size_t i = 0; i < n; i++) {
+        void *value = children_get_name(children, keys[i]);
+        if (relocate)
+            value = relocate(value, arg);
+        if (fresh.kind == CHILDREN_MAP) {
+            nmap_insert(fresh.map, keys[i], value);
+        } else {
+            entries(&fresh)[i].key = name_copy(keys[i]);
+            entries(&fresh)[i].value = value;
+        }
+    }
+    free(keys);
+    children_free(children);
+    *children = fresh;
+}
+
+ChildrenIterator children_iterator(Children *children) {
+    ChildrenIterator it = {0};
+    if (children->kind == CHILDREN_MAP)
+        it.map_it = nmap_iterator(children->map);
+    return it;
+}
+
+bool children_next(Children *children, ChildrenIterator *it,
+                   Name *key, void **value) {
+    if (children->kind == CHILDREN_MAP)
+        return nmap_next(children->map, &it->map_it, key, value);
+    if (it->index >= children->size)
+        return false;
+    *key = entries(children)[it->index].key;
+    *value = entries(children)[it->index].value;
+    it->index++;
+    return true;
+}
+
+char *make_children_string(Children *children) {
+    size_t n = children->size;
+    Name *keys = malloc(n * sizeof(Name) + 1);
+    const char **strings = malloc((n + 1) * sizeof(char *));
+    if (keys == NULL || strings == NULL)
+        fatal("Memory allocation failed");
+    sorted_keys(children, keys);
+    // Rozpakowujemy wszystkie nazwy do jednego bufora.
+    size_t total = 0;
+    for (size_t i = 0; i < n; i++)
+        total += name_length(keys[i]) + 1;
+    char *buffer = malloc(total + 1);
+    if (buffer == NULL)
+        fatal("Memory allocation failed");
+    char *position = buffer;
+    for (size_t i = 0; i < n; i++) {
+        strings[i] = position;
+        position += name_to_string(keys[i], position) + 1;
+    }
+    strings[n] = NULL;
+    char *result = make_contents_string(strings);
+    free(buffer);
+    free(strings);
+    free(keys);
+    return result;
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <stdbool.h>
+#include <sys/types.h>
+#include "NameMap.h"
+#include "Name.h"
+
+// Pojemność tablicy, w której trzymamy kilkoro dzieci. Przy wstawianiu
+// dziecka ponad tę liczbę dzieci przenosimy do hashmapy, a wracamy do
+// tablicy dopiero, gdy ich liczba spadnie do CHILDREN_SMALL / 2 (żeby przy
+// wstawianiu i usuwaniu na granicy nie alokować za każdym razem mapy).
+#define CHILDREN_SMALL 4
+
+typedef struct ChildrenEntry {
+    Name key;
+    void *value;
+} ChildrenEntry;
+
+// Gdzie są dzieci: jedyne dziecko (lub żadne) w polu one, kilkoro
+// w posortowanej tablicy small o pojemności CHILDREN_SMALL, a więcej
+// w hashmapie map.
+typedef enum ChildrenKind {
+    CHILDREN_ONE,
+    CHILDREN_ARRAY,
+    CHILDREN_MAP,
+} ChildrenKind;
+
+// Zbiór dzieci wierzchołka — odwzorowanie z nazw na wartości, z takim samym
+// kontraktem jak NameMap. Liść i wierzchołek z jednym dzieckiem nie zajmują
+// żadnej dodatkowej pamięci (struktura ma tyle, co jeden wpis), kilkoro
+// dzieci trzymamy w osobno zaalokowanej posortowanej tablicy, a hashmapę
+// alokujemy dopiero dla większej liczby dzieci. Tablicę zwalniamy dopiero,
+// gdy zbiór się opróżni.
+typedef struct Children {
+    uint32_t size;
+    uint8_t kind;
+    union {
+        ChildrenEntry one;
+        ChildrenEntry *small;
+        NameMap *map;
+    };
+} Children;
+
+// Inicjalizuje pusty zbiór dzieci.
+void children_init(Children *children);
+
+// Zwalnia pamięć zajmowaną przez zbiór (oddaje klucze i zwalnia ewentualną
+// hashmapę), ale nie zwalnia wartości.
+void children_free(Children *children);
+
+// Inicjalizuje `dst` jako kopię zbioru `src` (z tymi samymi wartościami).
+void children_copy(Children *dst, Children *src);
+
+// Zwraca wartość trzymaną pod kluczem `key` albo NULL, jeśli jej nie ma.
+void *children_get(Children *children, const char *key);
+
+// Tak jak children_get, ale dla nazwy w postaci spakowanej.
+void *children_get_name(Children *children, Name key);
+
+// Wstawia wartość pod kluczem `key` i zwraca true albo nic nie robi i zwraca
+// false, jeśli klucz już jest w zbiorze. Klucz jest kopiowany.
+bool children_insert(Children *children, const char *key, void *value);
+
+// Usuwa wartość spod klucza `key` (bez jej zwalniania) i zwraca true albo
+// zwraca false, jeśli klucza nie było.
+bool children_remove(Children *children, const char *key);
+
+// Zmienia klucz wartości z `key` na `new_key`, nie ruszając samej wartości
+// ani nie alokując pamięci (poza ewentualnym wpisem długiej nazwy do puli).
+// Zwraca fałsz i nic nie robi, jeśli nie ma klucza `key` albo jest już
+// klucz `new_key`.
+bool children_rename(Children *children, const char *key,
+                     const char *new_key);
+
+// Zwraca liczbę dzieci.
+size_t children_size(Children *children);
+
+// Zwraca liczbę bajtów zaalokowanych przez zbiór poza samą strukturą
+// Children (czyli zajmowanych przez tablicę albo hashmapę).
+size_t children_memory(Children *children);
+
+// Przebudowuje zbiór w świeżo zaalokowanej pamięci, w najmniejszej
+// postaci, w której się mieści (bez histerezy, z którą zmienia ją
+// children_remove). Jeśli relocate nie
+// jest NULL, to każdą wartość zastępuje wynikiem relocate(wartość, arg).
+void children_rebuild(Children *children, void *(*relocate)(void *, void *),
+                      void *arg);
+
+typedef struct ChildrenIterator {
+    size_t index;
+    NameMapIterator map_it;
+} ChildrenIterator;
+
+// Iterator po zbiorze, używany tak samo jak nmap_iterator i nmap_next.
+// Zbioru nie można modyfikować w trakcie iterowania. Zwracane klucze są
+// ważne tak długo, jak są w zbiorze (nie są kopiowane przez name_copy).
+ChildrenIterator children_iterator(Children *children);
+
+bool children_next(Children *children, ChildrenIterator *it,
+                   Name *key, void **value);
+
+// Zwraca posortowane nazwy dzieci oddzielone przecinkami.
+// Wołający musi zwolnić wynik.
+char *make_children_string(Children *children);
@@ -0,0 +1,502 @@
+#include "History.h"
+#include "Node.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Zapisana operacja. Pole end jest ustawiane (atomowo) na końcu, więc
+// niezerowe oznacza, że operacja jest zakończona i ma wynik.
+typedef struct HistoryOp {
+    TreeOpType type;
+    char *path, *target;
+    uint64_t begin, end;
+    int result;
+    char *list;
+} HistoryOp;
+
+struct History {
+    HistoryOp *ops;
+    size_t n_ops, capacity;
+};
+
+static uint64_t now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000ULL + t.tv_nsec + 1;
+}
+
+History *history_new(size_t capacity) {
+    History *h = malloc(sizeof(History));
+    if (h == NULL)
+        fatal("Memory allocation failed");
+    h->ops = calloc(capacity, sizeof(HistoryOp));
+    if (h->ops == NULL && capacity > 0)
+        fatal("Memory allocation failed");
+    h->n_ops = 0;
+    h->capacity = capacity;
+    return h;
+}
+
+void history_free(History *h) {
+    for (size_t i = 0; i < h->n_ops; i++) {
+        free(h->ops[i].path);
+        free(h->ops[i].target);
+        free(h->ops[i].list);
+    }
+    free(h->ops);
+    free(h);
+}
+
+size_t history_size(History *h) {
+    return __atomic_load_n(&h->n_ops, __ATOMIC_ACQUIRE);
+}
+
+int history_run(History *h, Tree *tree, TreeOpType type, const char *path,
+                const char *target) {
+    size_t i = __atomic_fetch_add(&h->n_ops, 1, __ATOMIC_RELAXED);
+    if (i >= h->capacity)
+        fatal("History capacity exceeded");
+    HistoryOp *op = &h->ops[i];
+    op->type = type;
+    op->path = strdup(path);
+    op->target = type == TREE_MOVE ? strdup(target) : NULL;
+    op->list = NULL;
+    op->begin = now();
+    switch (type) {
+        case TREE_CREATE:
+            op->result = tree_create(tree, path);
+            break;
+        case TREE_REMOVE:
+            op->result = tree_remove(tree, path);
+            break;
+        case TREE_MOVE:
+            op->result = tree_move(tree, path, target);
+            break;
+        default:
+            op->list = tree_list(tree, path);
+            op->result = op->list ? 0 : ENOENT;
+    }
+    __atomic_store_n(&op->end, now(), __ATOMIC_RELEASE);
+    return op->result;
+}
+
+// Sekwencyjny model drzewa: posortowane ścieżki wszystkich folderów razem
+// z korzeniem. W kolejności strcmp dzieci folderu są posortowane tak jak
+// w tree_list, bo '/' jest mniejsze od liter, a potomkowie folderu leżą
+// zaraz za nim.
+typedef struct Model {
+    char **paths;
+    size_t n, capacity;
+} Model;
+
+static void model_add(Model *m, char *path) {
+    if (m->n == m->capacity) {
+        m->capacity = m->capacity ? 2 * m->capacity : 16;
+        m->paths = realloc(m->paths, m->capacity * sizeof(char *));
+        if (m->paths == NULL)
+            fatal("Memory allocation failed");
+    }
+    m->paths[m->n++] = path;
+}
+
+// Odtwarza model ze stanu zapisanego przez model_state.
+static void model_parse(Model *m, const char *state) {
+    m->paths = NULL;
+    m->n = m->capacity = 0;
+    for (const char *end; (end = strchr(state, '\n')); state = end + 1)
+        model_add(m, strndup(state, end - state));
+}
+
+// Zapisuje model jako ścieżki zakończone znakami nowej linii.
+static char *model_state(Model *m) {
+    size_t length = 1;
+    for (size_t i = 0; i < m->n; i++)
+        length += strlen(m->paths[i]) + 1;
+    char *state = malloc(length), *p = state;
+    if (state == NULL)
+        fatal("Memory allocation failed");
+    for (size_t i = 0; i < m->n; i++) {
+        p = stpcpy(p, m->paths[i]);
+        *p++ = '\n';
+    }
+    *p = '\0';
+    return state;
+}
+
+static void model_free(Model *m) {
+    for (size_t i = 0; i < m->n; i++)
+        free(m->paths[i]);
+    free(m->paths);
+}
+
+static int compare_paths(const void *p1, const void *p2) {
+    return strcmp(*(char *const *) p1, *(char *const *) p2);
+}
+
+// Zwraca indeks pierwszej ścieżki nie mniejszej niż path.
+static size_t model_lower_bound(Model *m, const char *path) {
+    size_t lo = 0, hi = m->n;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (strcmp(m->paths[mid], path) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+static bool model_has(Model *m, const char *path) {
+    size_t i = model_lower_bound(m, path);
+    return i < m->n && strcmp(m->paths[i], path) == 0;
+}
+
+static bool has_prefix(const char *s, const char *prefix) {
+    return strncmp(s, prefix, strlen(prefix)) == 0;
+}
+
+// Sprawdza, czy folder o ścieżce path ma rodzica w modelu. Dla "/" zwraca
+// fałsz.
+static bool model_has_parent(Model *m, const char *path) {
+    char *parent = make_path_to_parent(path, NULL);
+    bool result = parent && model_has(m, parent);
+    free(parent);
+    return result;
+}
+
+static int model_create(Model *m, const char *path) {
+    if (!is_path_valid(path))
+        return EINVAL;
+    if (strcmp(path, "/") == 0)
+        return EEXIST;
+    if (!model_has_parent(m, path))
+        return ENOENT;
+    if (model_has(m, path))
+        return EEXIST;
+    model_add(m, strdup(path));
+    qsort(m->paths, m->n, sizeof(char *), compare_paths);
+    return 0;
+}
+
+static int model_remove(Model *m, const char *path) {
+    if (!is_path_valid(path))
+        return EINVAL;
+    if (strcmp(path, "/") == 0)
+        return EBUSY;
+    if (!model_has_parent(m, path))
+        return ENOENT;
+    size_t i = model_lower_bound(m, path);
+    if (i == m->n || strcmp(m->paths[i], path) != 0)
+        return ENOENT;
+    if (i + 1 < m->n && has_prefix(m->paths[i + 1], path))
+        return ENOTEMPTY;
+    free(m->paths[i]);
+    memmove(&m->paths[i], &m->paths[i + 1], (m->n - i - 1) * sizeof(char *));
+    m->n--;
+    return 0;
+}
+
+static int model_move(Model *m, const char *source, const char *target) {
+    if (strcmp(source, "/") == 0)
+        return EBUSY;
+    if (strcmp(target, "/") == 0)
+        return EEXIST;
+    if (!is_path_valid(target) || !is_path_valid(source))
+        return EINVAL;
+    if (!model_has_parent(m, source) || !model_has_parent(m, target))
+        return ENOENT;
+    if (!model_has(m, source))
+        return ENOENT;
+    if (strcmp(source, target) == 0)
+        return 0;
+    if (has_prefix(target, source))
+        return -1;
+    if (model_has(m, target))
+        return EEXIST;
+    size_t source_length = strlen(source), target_length = strlen(target);
+    for (size_t i = 0; i < m->n; i++) {
+        if (!has_prefix(m->paths[i], source))
+            continue;
+        size_t length = strlen(m->paths[i]) - source_length;
+        char *moved = malloc(target_length + length + 1);
+        if (moved == NULL)
+            fatal("Memory allocation failed");
+        memcpy(moved, target, target_length);
+        strcpy(moved + target_length, m->paths[i] + source_length);
+        free(m->paths[i]);
+        m->paths[i] = moved;
+    }
+    qsort(m->paths, m->n, sizeof(char *), compare_paths);
+    return 0;
+}
+
+static char *model_list(Model *m, const char *path) {
+    if (!is_path_valid(path))
+        return NULL;
+    size_t i = model_lower_bound(m, path);
+    if (i == m->n || strcmp(m->paths[i], path) != 0)
+        return NULL;
+    size_t length = strlen(path), n = 0;
+    const char **names = malloc((m->n + 1) * sizeof(char *));
+    if (names == NULL)
+        fatal("Memory allocation failed");
+    // Dzieci to potomkowie, których ścieżka ma tylko jeden komponent więcej.
+    for (i++; i < m->n && has_prefix(m->paths[i], path); i++) {
+        char *rest = m->paths[i] + length;
+        if (strchr(rest, '/') == rest + strlen(rest) - 1)
+            names[n++] = strndup(rest, strlen(rest) - 1);
+    }
+    names[n] = NULL;
+    char *result = make_contents_string(names);
+    for (size_t k = 0; k < n; k++)
+        free((char *) names[k]);
+    free(names);
+    return result;
+}
+
+// Wykonuje operację na modelu w stanie `state`. Jeśli da ona zapisany
+// wynik, zwraca nowy stan, a wpp NULL.
+static char *model_apply(const char *state, HistoryOp *op) {
+    Model m;
+    model_parse(&m, state);
+    bool ok;
+    if (op->type == TREE_CREATE) {
+        ok = model_create(&m, op->path) == op->result;
+    } else if (op->type == TREE_REMOVE) {
+        ok = model_remove(&m, op->path) == op->result;
+    } else if (op->type == TREE_MOVE) {
+        ok = model_move(&m, op->path, op->target) == op->result;
+    } else {
+        char *list = model_list(&m, op->path);
+        ok = list == NULL ? op->list == NULL
+                          : op->list != NULL && strcmp(list, op->list) == 0;
+        free(list);
+    }
+    char *result = ok ? model_state(&m) : NULL;
+    model_free(&m);
+    return result;
+}
+
+// Wywołanie lub powrót operacji, na liście dwukierunkowej posortowanej
+// po czasie.
+typedef struct Event {
+    size_t op;
+    bool call;
+    uint64_t time;
+    struct Event *match, *prev, *next;
+} Event;
+
+static int compare_events(const void *p1, const void *p2) {
+    const Event *e1 = p1, *e2 = p2;
+    if (e1->time != e2->time)
+        return e1->time < e2->time ? -1 : 1;
+    // Przy równych czasach wywołania traktujemy jako wcześniejsze, czyli
+    // operacje jako współbieżne.
+    return (int) e2->call - (int) e1->call;
+}
+
+// Zbiór odwiedzonych par (zbiór zliniowanych operacji, stan modelu).
+typedef struct Seen {
+    char **keys;
+    size_t *lengths;
+    size_t n, capacity;
+} Seen;
+
+static uint64_t hash_key(const char *key, size_t length) {
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < length; i++)
+        h = (h ^ (unsigned char) key[i]) * 1099511628211ULL;
+    return h;
+}
+
+static void seen_put(Seen *s, char *key, size_t length) {
+    size_t i = hash_key(key, length) & (s->capacity - 1);
+    while (s->keys[i])
+        i = (i + 1) & (s->capacity - 1);
+    s->keys[i] = key;
+    s->lengths[i] = length;
+    s->n++;
+}
+
+// Dodaje klucz do zbioru (przejmując go) i zwraca prawdę albo zwalnia go
+// i zwraca fałsz, jeśli już w nim był.
+static bool seen_add(Seen *s, char *key, size_t length) {
+    for (size_t i = hash_key(key, length) & (s->capacity - 1); s->keys[i];
+         i = (i + 1) & (s->capacity - 1)) {
+        if (s->lengths[i] == length && memcmp(s->keys[i], key, length) == 0) {
+            free(key);
+            return false;
+        }
+    }
+    if (2 * (s->n + 1) > s->capacity) {
+        Seen bigger = {calloc(2 * s->capacity, sizeof(char *)),
+                       calloc(2 * s->capacity, sizeof(size_t)),
+                       0, 2 * s->capacity};
+        if (bigger.keys == NULL || bigger.lengths == NULL)
+            fatal("Memory allocation failed");
+        for (size_t i = 0; i < s->capacity; i++) {
+            if (s->keys[i])
+                seen_put(&bigger, s->keys[i], s->lengths[i]);
+        }
+        free(s->keys);
+        free(s->lengths);
+        *s = bigger;
+    }
+    seen_put(s, key, length);
+    return true;
+}
+
+static char *make_key(const uint64_t *linearized, size_t words,
+                      const char *state, size_t *length) {
+    size_t state_length = strlen(state);
+    *length = words * sizeof(uint64_t) + state_length;
+    char *key = malloc(*length);
+    if (key == NULL)
+        fatal("Memory allocation failed");
+    memcpy(key, linearized, words * sizeof(uint64_t));
+    memcpy(key + words * sizeof(uint64_t), state, state_length);
+    return key;
+}
+
+// Wyjmuje wywołanie i powrót operacji z listy (lub wstawia je z powrotem).
+static void lift(Event *call) {
+    call->prev->next = call->next;
+    call->next->prev = call->prev;
+    Event *ret = call->match;
+    ret->prev->next = ret->next;
+    if (ret->next)
+        ret->next->prev = ret->prev;
+}
+
+static void unlift(Event *call) {
+    Event *ret = call->match;
+    ret->prev->next = ret;
+    if (ret->next)
+        ret->next->prev = ret;
+    call->prev->next = call;
+    call->next->prev = call;
+}
+
+bool history_check(History *h) {
+    size_t n = history_size(h);
+    // Wartownik na początku listy i wydarzenia wszystkich operacji
+    Event *events = malloc((2 * n + 1) * sizeof(Event));
+    if (events == NULL)
+        fatal("Memory allocation failed");
+    Event *head = &events[2 * n];
+    for (size_t i = 0; i < n; i++) {
+        uint64_t end = __atomic_load_n(&h->ops[i].end, __ATOMIC_ACQUIRE);
+        if (end == 0)
+            fatal("History contains an unfinished operation");
+        events[2 * i] = (Event) {i, true, h->ops[i].begin, NULL, NULL, NULL};
+        events[2 * i + 1] = (Event) {i, false, end, NULL, NULL, NULL};
+    }
+    qsort(events, 2 * n, sizeof(Event), compare_events);
+    Event **call_of = malloc((n + 1) * sizeof(Event *));
+    if (call_of == NULL)
+        fatal("Memory allocation failed");
+    for (size_t i = 0; i < 2 * n; i++) {
+        if (events[i].call)
+            call_of[events[i].op] = &events[i];
+    }
+    for (size_t i = 0; i < 2 * n; i++) {
+        if (!events[i].call) {
+            events[i].match = call_of[events[i].op];
+            call_of[events[i].op]->match = &events[i];
+        }
+        events[i].prev = i == 0 ? head : &events[i - 1];
+        events[i].next = i + 1 < 2 * n ? &events[i + 1] : NULL;
+    }
+    head->next = n > 0 ? &events[0] : NULL;
+    // Stos zliniowanych operacji razem ze stanem sprzed każdej z nich
+    Event **stack = malloc((n + 1) * sizeof(Event *));
+    char **states = malloc((n + 1) * sizeof(char *));
+    size_t words = (n + 63) / 64 + 1, depth = 0;
+    uint64_t *linearized = calloc(words, sizeof(uint64_t));
+    Seen seen = {calloc(64, sizeof(char *)), calloc(64, sizeof(size_t)),
+                 0, 64};
+    if (stack == NULL || states == NULL || linearized == NULL ||
+        seen.keys == NULL || seen.lengths == NULL)
+        fatal("Memory allocation failed");
+    char *state = strdup("/\n");
+    bool result = true;
+    Event *entry = head->next;
+    while (head->next) {
+        if (entry->call) {
+            char *next = model_apply(state, &h->ops[entry->op]);
+            bool advance = false;
+            if (next) {
+                linearized[entry->op / 64] |= 1ULL << (entry->op % 64);
+                size_t length;
+                char *key = make_key(linearized, words, next, &length);
+                if (seen_add(&seen, key, length)) {
+                    stack[depth] = entry;
+                    states[depth++] = state;
+                    state = next;
+                    lift(entry);
+                    entry = head->next;
+                    advance = true;
+                } else {
+                    linearized[entry->op / 64] &= ~(1ULL << (entry->op % 64));
+                    free(next);
+                }
+            }
+            if (!advance)
+                entry = entry->next;
+        } else {
+            // Doszliśmy do powrotu operacji, której nie umiemy zliniować
+            // przed nim, więc cofamy ostatnią decyzję.
+            if (depth == 0) {
+                result = false;
+                break;
+            }
+            entry = stack[--depth];
+            free(state);
+            state = states[depth];
+            linearized[entry->op / 64] &= ~(1ULL << (entry->op % 64));
+            unlift(entry);
+            entry = entry->next;
+        }
+    }
+    free(state);
+    while (depth > 0)
+        free(states[--depth]);
+    for (size_t i = 0; i < seen.capacity; i++)
+        free(seen.keys[i]);
+    free(seen.keys);
+    free(seen.lengths);
+    free(linearized);
+    free(states);
+    free(stack);
+    free(call_of);
+    free(events);
+    return result;
+}
+
+int history_dump(History *h, int fd) {
+    static const char *names[] = {
+            [TREE_CREATE] = "create",
+            [TREE_REMOVE] = "remove",
+            [TREE_MOVE] = "move",
+            [TREE_LIST] = "list",
+    };
+    size_t n = history_size(h);
+    uint64_t start = UINT64_MAX;
+    for (size_t i = 0; i < n; i++) {
+        if (h->ops[i].begin < start)
+            start = h->ops[i].begin;
+    }
+    for (size_t i = 0; i < n; i++) {
+        HistoryOp *op = &h->ops[i];
+        if (dprintf(fd, "%llu %llu %s %s%s%s -> %d%s%s\n",
+                    (unsigned long long) (op->begin - start),
+                    (unsigned long long) (op->end - start),
+                    names[op->type], op->path, op->target ? " " : "",
+                    op->target ? op->target : "", op->result,
+                    op->list ? " " : "", op->list ? op->list : "") < 0)
+            return -1;
+    }
+    return 0;
+}
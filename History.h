@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "Tree.h"
+
+// Zapis współbieżnej historii operacji na drzewie i sprawdzanie jej
+// liniowości. Wątki wykonują operacje przez history_run, które zapisuje
+// czas wywołania i powrotu oraz wynik, a history_check szuka kolejności
+// operacji zgodnej z tymi czasami, w której sekwencyjny model drzewa daje
+// te same wyniki (algorytm Wing–Gong z zapamiętywaniem stanów, jak
+// w sprawdzarce Lowe'a). Służy do testowania zmian w protokole
+// synchronizacji.
+typedef struct History History;
+
+// Tworzy pustą historię na co najwyżej `capacity` operacji.
+History *history_new(size_t capacity);
+
+void history_free(History *history);
+
+// Wykonuje operację na drzewie (target jest używane tylko dla TREE_MOVE),
+// zapisuje ją w historii i zwraca jej wynik (dla TREE_LIST 0, jeśli folder
+// istnieje, a ENOENT wpp). Może być wołane współbieżnie. Drzewo musi być
+// puste, gdy zaczyna się pierwsza zapisana operacja, i nie może być
+// zmieniane inaczej niż przez history_run.
+int history_run(History *history, Tree *tree, TreeOpType type,
+                const char *path, const char *target);
+
+// Zwraca liczbę zapisanych operacji.
+size_t history_size(History *history);
+
+// Sprawdza, czy zapisana historia jest liniowa. Wszystkie operacje muszą
+// być zakończone. Koszt jest wykładniczy w liczbie operacji wykonywanych
+// jednocześnie, więc historia powinna mieć co najwyżej kilkaset operacji.
+bool history_check(History *history);
+
+// Zapisuje historię do deskryptora `fd`, po jednej operacji w linii
+// (czasy w nanosekundach od pierwszej operacji). Zwraca 0 albo -1, jeśli
+// zapis się nie udał.
+int history_dump(History *history, int fd);
@@ -0,0 +1,267 @@
+#include "Name.h"
+#include "Node.h"
+#include <assert.h>
+#include <errno.h>
+#include <malloc.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LETTERS_PER_WORD 12
+#define BITS_PER_LETTER 5
+#define INITIAL_POOL_BUCKETS 64
+
+// Wpis w puli długich nazw.
+typedef struct Interned {
+    struct Interned *next;
+    // Zmieniany atomowo; do zera schodzi tylko pod mutexem puli (patrz
+    // name_release).
+    size_t refs;
+    size_t length;
+    unsigned int hash;
+    char str[];
+} Interned;
+
+// Pula jest wspólna dla wszystkich drzew, więc chronimy ją jednym mutexem.
+// Bierzemy go tylko przy tworzeniu długiej nazwy (name_new) i oddawaniu
+// ostatniej referencji do niej; wyszukiwanie (name_lookup) i kopiowanie
+// referencji obywają się bez niego.
+static struct {
+    pthread_mutex_t mutex;
+    Interned **buckets;
+    size_t n_buckets, size;
+} pool = {PTHREAD_MUTEX_INITIALIZER, NULL, 0, 0};
+
+static unsigned int string_hash(const char *str, size_t length) {
+    unsigned int hash = 17;
+    for (size_t i = 0; i < length; i++)
+        hash = (hash << 3) + hash + str[i];
+    return hash;
+}
+
+static Interned *get_interned(Name name) {
+    return (Interned *) (uintptr_t) name.lo;
+}
+
+static Name make_interned(Interned *entry) {
+    Name name = {NAME_INTERNED | entry->hash, (uint64_t) (uintptr_t) entry};
+    return name;
+}
+
+static bool is_interned(Name name) {
+    return (name.hi & NAME_INTERNED) != 0;
+}
+
+static bool is_probe(Name name) {
+    return (name.hi & NAME_PROBE) != 0;
+}
+
+// Zwraca napis długiej nazwy (z puli albo z name_lookup) i jego długość.
+static const char *long_string(Name name, size_t *length) {
+    if (is_probe(name)) {
+        const char *str = (const char *) (uintptr_t) name.lo;
+        *length = strlen(str);
+        return str;
+    }
+    *length = get_interned(name)->length;
+    return get_interned(name)->str;
+}
+
+static Name encode(const char *str, size_t length) {
+    Name name = {0, 0};
+    for (size_t i = 0; i < length; i++) {
+        assert(str[i] >= 'a' && str[i] <= 'z');
+        uint64_t letter = str[i] - 'a' + 1;
+        int shift = BITS_PER_LETTER * (LETTERS_PER_WORD - 1 -
+                                       i % LETTERS_PER_WORD);
+        if (i < LETTERS_PER_WORD)
+            name.hi |= letter << shift;
+        else
+            name.lo |= letter << shift;
+    }
+    return name;
+}
+
+// Szuka wpisu w puli, wymaga mutexa puli.
+static Interned *pool_find(const char *str, size_t length,
+                           unsigned int hash) {
+    if (pool.n_buckets == 0)
+        return NULL;
+    for (Interned *e = pool.buckets[hash % pool.n_buckets]; e; e = e->next) {
+        if (e->hash == hash && e->length == length &&
+            memcmp(e->str, str, length) == 0)
+            return e;
+    }
+    return NULL;
+}
+
+// Podwaja liczbę kubełków puli, wymaga mutexa puli.
+static void pool_grow(void) {
+    size_t n = pool.n_buckets ? 2 * pool.n_buckets : INITIAL_POOL_BUCKETS;
+    Interned **buckets = calloc(n, sizeof(Interned *));
+    if (buckets == NULL)
+        fatal("Memory allocation failed");
+    for (size_t h = 0; h < pool.n_buckets; h++) {
+        for (Interned *e = pool.buckets[h]; e;) {
+            Interned *next = e->next;
+            e->next = buckets[e->hash % n];
+            buckets[e->hash % n] = e;
+            e = next;
+        }
+    }
+    free(pool.buckets);
+    pool.buckets = buckets;
+    pool.n_buckets = n;
+}
+
+Name name_new(const char *str) {
+    size_t length = strlen(str);
+    if (length <= NAME_INLINE_LENGTH)
+        return encode(str, length);
+    unsigned int hash = string_hash(str, length);
+    ptry(pthread_mutex_lock(&pool.mutex));
+    Interned *entry = pool_find(str, length, hash);
+    if (entry == NULL) {
+        if (pool.size >= 2 * pool.n_buckets)
+            pool_grow();
+        entry = malloc(sizeof(Interned) + length + 1);
+        if (entry == NULL)
+            fatal("Memory allocation failed");
+        entry->refs = 0;
+        entry->length = length;
+        entry->hash = hash;
+        memcpy(entry->str, str, length + 1);
+        entry->next = pool.buckets[hash % pool.n_buckets];
+        pool.buckets[hash % pool.n_buckets] = entry;
+        pool.size++;
+    }
+    __atomic_add_fetch(&entry->refs, 1, __ATOMIC_RELAXED);
+    ptry(pthread_mutex_unlock(&pool.mutex));
+    return make_interned(entry);
+}
+
+Name name_lookup(const char *str) {
+    size_t length = strlen(str);
+    if (length <= NAME_INLINE_LENGTH)
+        return encode(str, length);
+    Name name = {NAME_INTERNED | NAME_PROBE | string_hash(str, length),
+                 (uint64_t) (uintptr_t) str};
+    return name;
+}
+
+bool name_equal_probe(Name a, Name b) {
+    size_t length_a, length_b;
+    const char *str_a = long_string(a, &length_a);
+    const char *str_b = long_string(b, &length_b);
+    return length_a == length_b && memcmp(str_a, str_b, length_a) == 0;
+}
+
+Name name_copy(Name name) {
+    assert(!is_probe(name));
+    // Wołający ma już referencję, więc wpis nie zniknie w międzyczasie.
+    if (is_interned(name))
+        __atomic_add_fetch(&get_interned(name)->refs, 1, __ATOMIC_RELAXED);
+    return name;
+}
+
+void name_release(Name name) {
+    assert(!is_probe(name));
+    if (!is_interned(name))
+        return;
+    Interned *entry = get_interned(name);
+    // Dopóki nie oddajemy ostatniej referencji, wystarczy zmniejszyć licznik.
+    // Ostatnią oddajemy pod mutexem, żeby name_new nie znalazło w puli wpisu,
+    // który właśnie zwalniamy.
+    size_t refs = __atomic_load_n(&entry->refs, __ATOMIC_RELAXED);
+    while (refs > 1) {
+        if (__atomic_compare_exchange_n(&entry->refs, &refs, refs - 1, true,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+            return;
+    }
+    ptry(pthread_mutex_lock(&pool.mutex));
+    if (__atomic_sub_fetch(&entry->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        Interned **pe = &pool.buckets[entry->hash % pool.n_buckets];
+        while (*pe != entry)
+            pe = &(*pe)->next;
+        *pe = entry->next;
+        pool.size--;
+        free(entry);
+    }
+    ptry(pthread_mutex_unlock(&pool.mutex));
+}
+
+size_t name_pool_memory(void) {
+    ptry(pthread_mutex_lock(&pool.mutex));
+    size_t bytes = pool.buckets ? malloc_usable_size(pool.buckets) : 0;
+    for (size_t h = 0; h < pool.n_buckets; h++) {
+        for (Interned *e = pool.buckets[h]; e; e = e->next)
+            bytes += malloc_usable_size(e);
+    }
+    ptry(pthread_mutex_unlock(&pool.mutex));
+    return bytes;
+}
+
+unsigned int name_hash(Name name) {
+    // Długa nazwa ma hash napisu w hi, a jej lo zależy od tego, czy pochodzi
+    // z puli, czy z name_lookup, więc go pomijamy.
+    uint64_t x = is_interned(name) ? name.hi & ~NAME_PROBE :
+                 name.hi * 0x9E3779B97F4A7C15ULL ^ name.lo;
+    x ^= x >> 29;
+    x *= 0xBF58476D1CE4E5B9ULL;
+    x ^= x >> 32;
+    return (unsigned int) x;
+}
+
+int name_compare(Name a, Name b) {
+    if (!is_interned(a) && !is_interned(b)) {
+        if (a.hi != b.hi)
+            return a.hi < b.hi ? -1 : 1;
+        if (a.lo != b.lo)
+            return a.lo < b.lo ? -1 : 1;
+        return 0;
+    }
+    if (name_equal(a, b))
+        return 0;
+    char str_a[MAX_FOLDER_NAME_LENGTH + 1], str_b[MAX_FOLDER_NAME_LENGTH + 1];
+    name_to_string(a, str_a);
+    name_to_string(b, str_b);
+    return strcmp(str_a, str_b);
+}
+
+size_t name_length(Name name) {
+    size_t length;
+    if (is_interned(name)) {
+        long_string(name, &length);
+        return length;
+    }
+    length = 0;
+    while (length < NAME_INLINE_LENGTH) {
+        uint64_t word = length < LETTERS_PER_WORD ? name.hi : name.lo;
+        int shift = BITS_PER_LETTER * (LETTERS_PER_WORD - 1 -
+                                       length % LETTERS_PER_WORD);
+        if (((word >> shift) & 31) == 0)
+            break;
+        length++;
+    }
+    return length;
+}
+
+size_t name_to_string(Name name, char *buf) {
+    size_t length;
+    if (is_interned(name)) {
+        const char *str = long_string(name, &length);
+        memcpy(buf, str, length + 1);
+        return length;
+    }
+    length = 0;
+    while (length < NAME_INLINE_LENGTH) {
+        uint64_t word = length < LETTERS_PER_WORD ? name.hi : name.lo;
+        int shift = BITS_PER_LETTER * (LETTERS_PER_WORD - 1 -
+                                       length % LETTERS_PER_WORD);
+        uint64_t letter = (word >> shift) & 31;
+        if (letter == 0)
+            break;
+        buf[length++] = (char) ('a' + letter - 1);
+    }
+    buf[length] = '\0';
+    return length;
+}
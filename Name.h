@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Maksymalna długość nazwy trzymanej bezpośrednio w strukturze Name. Nazwy
+// folderów składają się tylko z liter 'a'-'z', więc każdą literę kodujemy
+// na 5 bitach, po 12 liter w każdym z dwóch słów.
+#define NAME_INLINE_LENGTH 24
+
+// Nazwa folderu w postaci spakowanej. Krótkie nazwy są zapisane bezpośrednio
+// w słowach hi i lo (literami od najstarszych bitów, kod 0 oznacza koniec
+// nazwy), dzięki czemu porównanie słów daje porządek leksykograficzny.
+// Dłuższe nazwy są trzymane we wspólnej puli z licznikiem referencji:
+// wtedy hi ma ustawiony najstarszy bit i hash napisu w młodszych 32 bitach,
+// a lo jest wskaźnikiem do wpisu w puli. Ta sama nazwa z puli ma zawsze tę
+// samą reprezentację, więc do sprawdzenia równości wystarczy porównać słowa.
+typedef struct Name {
+    uint64_t hi, lo;
+} Name;
+
+// Bit w słowie hi oznaczający długą nazwę.
+#define NAME_INTERNED (1ULL << 63)
+// Bit w słowie hi oznaczający długą nazwę z name_lookup: wtedy lo wskazuje
+// na napis wołającego, a nie na wpis w puli.
+#define NAME_PROBE (1ULL << 62)
+
+// Tworzy nazwę z napisu złożonego z liter 'a'-'z'. Jeśli nazwa jest długa,
+// wstawia ją do puli lub zwiększa licznik referencji istniejącego wpisu.
+Name name_new(const char *str);
+
+// Tworzy nazwę do wyszukania w zbiorze, nie biorąc referencji ani mutexa
+// puli. Wynik można tylko porównywać (name_equal, name_compare, name_hash)
+// z nazwami ze zbiorów, które wołający czyta pod lockiem, i tylko dopóki
+// jest ważny napis `str`. Nie wolno go kopiować ani oddawać.
+Name name_lookup(const char *str);
+
+// Zwraca kolejną referencję do tej samej nazwy.
+Name name_copy(Name name);
+
+// Oddaje referencję do nazwy (dla krótkich nazw nic nie robi).
+void name_release(Name name);
+
+// Porównuje długie nazwy o różnych słowach, z których co najmniej jedna
+// pochodzi z name_lookup.
+bool name_equal_probe(Name a, Name b);
+
+static inline bool name_equal(Name a, Name b) {
+    if (a.hi == b.hi && a.lo == b.lo)
+        return true;
+    // Nazwy z puli są równe tylko przy równych słowach, a nazwę z name_lookup
+    // porównujemy napisem, o ile zgadzają się hashe.
+    return ((a.hi | b.hi) & NAME_PROBE) &&
+           (a.hi & ~NAME_PROBE) == (b.hi & ~NAME_PROBE) &&
+           name_equal_probe(a, b);
+}
+
+// Hash nazwy do użycia w hashmapach.
+unsigned int name_hash(Name name);
+
+// Porównuje nazwy leksykograficznie, zwraca wynik tak jak strcmp.
+int name_compare(Name a, Name b);
+
+// Zwraca długość nazwy.
+size_t name_length(Name name);
+
+// Zwraca liczbę bajtów zajmowanych przez pulę długich nazw (wspólną dla
+// wszystkich drzew).
+size_t name_pool_memory(void);
+
+// Zapisuje nazwę jako napis do bufora `buf`, który musi mieć co najmniej
+// name_length(name) + 1 bajtów. Zwraca liczbę zapisanych liter.
+size_t name_to_string(Name name, char *buf);
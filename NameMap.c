@@ -0,0 +1,162 @@
+#include <assert.h>
+#include <malloc.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "NameMap.h"
+
+// We fix the number of hash buckets for simplicity.
+#define N_BUCKETS 8
+
+typedef struct Pair Pair;
+
+struct Pair {
+    Name key;
+    void* value;
+    Pair* next; // Next item in a single-linked list.
+};
+
+struct NameMap {
+    Pair* buckets[N_BUCKETS]; // Linked lists of key-value pairs.
+    size_t size; // total number of entries in map.
+};
+
+static unsigned int get_hash(Name key);
+
+NameMap* nmap_new()
+{
+    NameMap* map = malloc(sizeof(NameMap));
+    if (!map)
+        return NULL;
+    memset(map, 0, sizeof(NameMap));
+    return map;
+}
+
+void nmap_free(NameMap* map)
+{
+    for (int h = 0; h < N_BUCKETS; ++h) {
+        for (Pair* p = map->buckets[h]; p;) {
+            Pair* q = p;
+            p = p->next;
+            name_release(q->key);
+            free(q);
+        }
+    }
+    free(map);
+}
+
+static Pair* nmap_find(NameMap* map, int h, Name key)
+{
+    for (Pair* p = map->buckets[h]; p; p = p->next) {
+        if (name_equal(key, p->key))
+            return p;
+    }
+    return NULL;
+}
+
+void* nmap_get(NameMap* map, Name key)
+{
+    int h = get_hash(key);
+    Pair* p = nmap_find(map, h, key);
+    if (p)
+        return p->value;
+    else
+        return NULL;
+}
+
+bool nmap_insert(NameMap* map, Name key, void* value)
+{
+    if (!value)
+        return false;
+    int h = get_hash(key);
+    Pair* p = nmap_find(map, h, key);
+    if (p)
+        return false; // Already exists.
+    Pair* new_p = malloc(sizeof(Pair));
+    new_p->key = name_copy(key);
+    new_p->value = value;
+    new_p->next = map->buckets[h];
+    map->buckets[h] = new_p;
+    map->size++;
+    return true;
+}
+
+bool nmap_remove(NameMap* map, Name key)
+{
+    int h = get_hash(key);
+    Pair** pp = &(map->buckets[h]);
+    while (*pp) {
+        Pair* p = *pp;
+        if (name_equal(key, p->key)) {
+            *pp = p->next;
+            name_release(p->key);
+            free(p);
+            map->size--;
+            return true;
+        }
+        pp = &(p->next);
+    }
+    return false;
+}
+
+bool nmap_rename(NameMap* map, Name key, Name new_key)
+{
+    int new_h = get_hash(new_key);
+    if (nmap_find(map, new_h, new_key))
+        return false;
+    int h = get_hash(key);
+    Pair** pp = &(map->buckets[h]);
+    while (*pp) {
+        Pair* p = *pp;
+        if (name_equal(key, p->key)) {
+            *pp = p->next;
+            name_release(p->key);
+            p->key = name_copy(new_key);
+            p->next = map->buckets[new_h];
+            map->buckets[new_h] = p;
+            return true;
+        }
+        pp = &(p->next);
+    }
+    return false;
+}
+
+size_t nmap_size(NameMap* map)
+{
+    return map->size;
+}
+
+size_t nmap_memory(NameMap* map)
+{
+    size_t bytes = malloc_usable_size(map);
+    for (int h = 0; h < N_BUCKETS; ++h) {
+        for (Pair* p = map->buckets[h]; p; p = p->next)
+            bytes += malloc_usable_size(p);
+    }
+    return bytes;
+}
+
+NameMapIterator nmap_iterator(NameMap* map)
+{
+    NameMapIterator it = { 0, map->buckets[0] };
+    return it;
+}
+
+bool nmap_next(NameMap* map, NameMapIterator* it, Name* key, void** value)
+{
+    Pair* p = it->pair;
+    while (!p && it->bucket < N_BUCKETS - 1) {
+        p = map->buckets[++it->bucket];
+    }
+    if (!p)
+        return false;
+    *key = p->key;
+    *value = p->value;
+    it->pair = p->next;
+    return true;
+}
+
+static unsigned int get_hash(Name key)
+{
+    return name_hash(key) % N_BUCKETS;
+}
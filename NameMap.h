@@ -0,0 +1,69 @@
+#pragma once
+#include <stdbool.h>
+#include <sys/types.h>
+#include "Name.h"
+
+// A copy of HashMap (see HashMap.h) keyed by packed folder names instead of
+// C-strings, used for sets of children.
+// A structure representing a mapping from keys to values.
+// Keys are folder names (see Name.h), all distinct.
+// Values are non-null pointers (void*, which you can cast to any other pointer type).
+typedef struct NameMap NameMap;
+
+// Create a new, empty map.
+NameMap* nmap_new();
+
+// Clear the map and free its memory. This frees the map and releases the keys
+// copied by nmap_insert, but does not free any values.
+void nmap_free(NameMap* map);
+
+// Get the value stored under `key`, or NULL if not present.
+void* nmap_get(NameMap* map, Name key);
+
+// Insert a `value` under `key` and return true,
+// or do nothing and return false if `key` already exists in the map.
+// `value` must not be NULL.
+// (The caller can release `key` at any time - the map internally uses a copy of it).
+bool nmap_insert(NameMap* map, Name key, void* value);
+
+// Remove the value under `key` and return true (the value is not free'd),
+// or do nothing and return false if `key` was not present.
+bool nmap_remove(NameMap* map, Name key);
+
+// Move the value under `key` to `new_key` (reusing its entry, so without
+// allocating) and return true, or do nothing and return false if `key` was
+// not present or `new_key` already exists in the map.
+bool nmap_rename(NameMap* map, Name key, Name new_key);
+
+// Return the number of elements in the map.
+size_t nmap_size(NameMap* map);
+
+// Return the number of bytes allocated for the map and its entries
+// (as reported by malloc_usable_size, so including allocator rounding).
+size_t nmap_memory(NameMap* map);
+
+typedef struct NameMapIterator NameMapIterator;
+
+// Return an iterator to the map. See `nmap_next`.
+NameMapIterator nmap_iterator(NameMap* map);
+
+// Set `*key` and `*value` to the current element pointed by iterator and
+// move the iterator to the next element.
+// If there are no more elements, leaves `*key` and `*value` unchanged and
+// returns false.
+//
+// The map cannot be modified between calls to `nmap_iterator` and `nmap_next`.
+//
+// Usage: ```
+//     Name key;
+//     void* value;
+//     NameMapIterator it = nmap_iterator(map);
+//     while (nmap_next(map, &it, &key, &value))
+//         foo(key, value);
+// ```
+bool nmap_next(NameMap* map, NameMapIterator* it, Name* key, void** value);
+
+struct NameMapIterator {
+    int bucket;
+    void* pair;
+};
@@ -1,41 +1,150 @@
+#define _GNU_SOURCE
 #include "Node.h"
+#include "Trace.h"
 #include <errno.h>
 #include <malloc.h>
+#include <sched.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 // Konwencja używana w synchronizacji:
-// z funkcji czytających z hashmapy children (jak find i iteratora) i pola
+// z funkcji czytających ze zbioru children (jak find i iteratora) i pola
 // father można korzystać, jeśli się jest czytelnikiem lub pisarzem danego Node,
-// z funkcji modyfukujących hashmapę (jak insert i remove) oraz pole father
+// z funkcji modyfukujących zbiór (jak insert i remove) oraz pole father
 // tylko jeśli się jest pisarzem danego node, a z pozostałych zmiennych
-// składowych Node można korzystać tylko, gdy się ma mutexa.
+// składowych Node można korzystać tylko, gdy się ma mutexa. Pisarz zmienia
+// children dodatkowo pod mutexem (przez modify_begin i modify_end), bo
+// czytający ze snapshotów nie biorą readlocków, tylko mutexa.
 typedef struct Node {
-    HashMap *children;
+    Children children;
     // Zmienne warunkowe do czekania na dostęp do czytelni
     pthread_cond_t readlock, writelock;
     // Zmienne warunkowe do czekania na wyzerowanie stanu semafora
     // (jeśli semafor jest podniesiony, to czekamy aż proces, dla którego
     // został podniesiony, go opuści, a dopiero potem wchodzimy do protokołu)
     pthread_cond_t rprio, wprio;
-    // Zmienne przechowujące stan semafora
+    // Zmienne przechowujące stan semafora. Zmieniane pod mutexem, ale
+    // zapisywane atomowo, bo czekający sprawdzają je też bez mutexa (patrz
+    // wait_for).
     int rstate, wstate;
     // Odpowiednio liczba czytelników i pisarzy
     // odpowiednio czekających i działających
     int rwait, wwait, rrun, wrun;
+    // Liczba procesów śpiących na zmiennych warunkowych readlock, writelock,
+    // rprio i wprio — jeśli nikt nie śpi, to nikogo nie budzimy
+    int rsleep, wsleep, rpsleep, wpsleep;
+#ifdef TREE_SPIN
+    // Średnia liczba obrotów, po których czekający się doczekali, w
+    // jednostkach 1 / SPIN_SCALE, na podstawie której dobieramy, jak długo
+    // kręcić się przed zaśnięciem (czytana i zmieniana atomowo bez mutexa)
+    int spin;
+#endif
     struct Node *father;
     // Wysokość — aktualizowana przy zdobywaniu locków, czytana przy oddawaniu.
     int height;
     pthread_mutex_t mutex;
+    // Stan potrzebny snapshotom, które mogą nie widzieć obecnych children,
+    // albo NULL, jeśli widzą je wszystkie aktywne snapshoty (patrz NodeHistory)
+    struct NodeHistory *history;
+    // Jeśli source nie jest NULL, to wierzchołek jest leniwą kopią
+    // wierzchołka source w postaci ze snapshotu copy->version, a children
+    // jest puste, dopóki ktoś go nie użyje (patrz materialize). Source jest
+    // czytane atomowo, a zerowane i zmieniane razem z copy pod mutexem.
+    struct Node *source;
+    struct LazyCopy *copy;
 } Node;
 
+// Liczba wierzchołków, które node_copy_at materializuje od razu.
+#define COPY_EAGER_NODES 256
+
+// Snapshot wspólny dla wszystkich leniwych kopii z jednego node_copy_at.
+// Trzyma przy życiu wersje dzieci (i usunięte wierzchołki), z których
+// kopie będą jeszcze tworzone. Kończymy go, gdy ostatnia kopia się
+// zmaterializuje.
+typedef struct LazyCopy {
+    Versions *versions;
+    uint64_t version;
+    // Liczba leniwych wierzchołków (atomowa)
+    size_t refs;
+} LazyCopy;
+
+// Zamrożona wersja dzieci wierzchołka. Jest widoczna dla snapshotów
+// o wersjach od stamp do stempla następnej (nowszej) wersji wyłącznie.
+typedef struct ChildrenVersion {
+    Children children;
+    uint64_t stamp;
+    struct ChildrenVersion *next;
+} ChildrenVersion;
+
+// Osobna alokacja na stan wierzchołka potrzebny snapshotom, żeby nie płacić
+// za niego w każdym wierzchołku. Wierzchołek ma ją wtedy i tylko wtedy, gdy
+// jest na liście w Versions, i traci przy końcu snapshotu, po którym
+// wszystkie aktywne snapshoty widzą jego obecne dzieci. Wierzchołek bez niej
+// zachowuje się tak, jakby miał stempel 0.
+typedef struct NodeHistory {
+    // Stempel wersji, w której ostatnio zmieniono (albo stworzono) children
+    uint64_t stamp;
+    // Starsze wersje children potrzebne jeszcze snapshotom, od najnowszej
+    ChildrenVersion *versions;
+    // Następny wierzchołek na liście w Versions i wskaźnik na liście, który
+    // wskazuje na ten wierzchołek (pole next poprzedniego albo początek
+    // listy), żeby można go było z niej wyjąć bez szukania
+    struct Node *next;
+    struct Node **pprev;
+} NodeHistory;
+
+// Wierzchołek usunięty z drzewa w wersji stamp, który mogą jeszcze widzieć
+// starsze snapshoty.
+typedef struct Retired {
+    Node *node;
+    uint64_t stamp;
+    struct Retired *next;
+} Retired;
+
+struct Versions {
+    // Szeregowanie początków snapshotów
+    pthread_mutex_t begin_mutex;
+    // Chroni active, retired i przycinanie historii
+    pthread_mutex_t mutex;
+    // Wersja najnowszego snapshotu (atomowa). Pisarz na początku sekcji
+    // krytycznej zapamiętuje ją jako swoją epokę i stempluje zmiany przez
+    // epokę + 1, więc widzą je snapshoty o wersjach od epoki + 1.
+    uint64_t clock;
+    // Liczba pisarzy w sekcji krytycznej o epoce parzystej i nieparzystej
+    // (atomowe). Snapshot o wersji clock + 1 czeka, aż skończą się sekcje
+    // o epoce clock, więc nie widzi połowy operacji, a nie blokuje pisarzy.
+    size_t writers[2];
+    // Posortowane wersje aktywnych snapshotów i najnowsza z nich (0, jeśli
+    // nie ma żadnego), czytana przez pisarzy bez mutexa
+    uint64_t *active;
+    size_t n_active, active_capacity;
+    uint64_t newest;
+    Retired *retired;
+    // Chroni listę wierzchołków z NodeHistory
+    pthread_mutex_t dirty_mutex;
+    Node *dirty;
+};
+
+// Epoka sekcji krytycznej pisarza, w której jest wątek (patrz Versions),
+// i czy w tej sekcji dał jakiemuś wierzchołkowi NodeHistory albo odłożył
+// usunięty wierzchołek na listę Retired.
+static __thread uint64_t write_epoch;
+static __thread bool write_history;
+
 Node *get_father(Node *node) {
     if (node == NULL)
         return NULL;
     return node->father;
 }
 
-HashMap *get_children(Node *node) {
-    return node->children;
+static void materialize(Node *node);
+static Children *children_at(Node *node, uint64_t version);
+static void stamp_new(Versions *v, Node *node);
+
+Children *get_children(Node *node) {
+    materialize(node);
+    return &node->children;
 }
 
 void set_father(Node *node, Node *father) {
@@ -59,33 +168,180 @@ void set_height(Node *node, int h) {
     ptry(pthread_mutex_unlock(&node->mutex));
 }
 
-Node *node_new(Node *father) {
+// Tworzy wierzchołek o podanej wysokości bez pytania ojca o jego wysokość,
+// więc można to robić pod mutexem ojca.
+static Node *node_alloc(Node *father, int height) {
     Node *n = malloc(sizeof(Node));
     if (n == NULL)
         fatal("Memory allocation failed");
-    n->children = hmap_new();
+    children_init(&n->children);
     n->rwait = n->wwait = n->rrun = n->wrun = 0;
     n->rstate = n->wstate = 0;
+    n->rsleep = n->wsleep = n->rpsleep = n->wpsleep = 0;
+#ifdef TREE_SPIN
+    n->spin = 0;
+#endif
     n->father = father;
+    n->history = NULL;
+    n->source = NULL;
+    n->copy = NULL;
+    n->height = height;
     ptry(pthread_cond_init(&n->readlock, 0));
     ptry(pthread_cond_init(&n->writelock, 0));
     ptry(pthread_cond_init(&n->rprio, 0));
     ptry(pthread_cond_init(&n->wprio, 0));
     ptry(pthread_mutex_init(&n->mutex, 0));
-    set_height(n, get_height(father) + 1);
     return n;
 }
 
+Node *node_new(Node *father) {
+    return node_alloc(father, get_height(father) + 1);
+}
+
+// Oddaje referencję leniwej kopii do wspólnego snapshotu i kończy go,
+// jeśli była ostatnia (chyba że end_snapshot jest fałszem, co oznacza,
+// że całe drzewo jest właśnie zwalniane).
+static void lazy_release(LazyCopy *copy, bool end_snapshot) {
+    if (__atomic_sub_fetch(&copy->refs, 1, __ATOMIC_ACQ_REL) > 0)
+        return;
+    if (end_snapshot)
+        versions_snapshot_end(copy->versions, copy->version);
+    free(copy);
+}
+
+static Node *lazy_new(Node *source, LazyCopy *copy, Node *father,
+                      int height) {
+    Node *n = node_alloc(father, height);
+    n->source = source;
+    n->copy = copy;
+    __atomic_add_fetch(&copy->refs, 1, __ATOMIC_RELAXED);
+    return n;
+}
+
+// Sprawdza, czy zwykły (nie leniwy) wierzchołek nie miał dzieci w podanej
+// wersji — wtedy jego kopia nie musi być leniwa i trzymać snapshotu. Woła
+// się ją pod mutexami kopii i źródła, więc nie czeka na mutex wierzchołka
+// i w razie wątpliwości zwraca fałsz.
+static bool empty_at(Node *node, uint64_t version) {
+    if (__atomic_load_n(&node->source, __ATOMIC_ACQUIRE) != NULL ||
+        pthread_mutex_trylock(&node->mutex) != 0)
+        return false;
+    Children *children = children_at(node, version);
+    bool empty = node->source == NULL && children != NULL &&
+                 children_size(children) == 0;
+    ptry(pthread_mutex_unlock(&node->mutex));
+    return empty;
+}
+
+// Zamienia leniwą kopię w zwykły wierzchołek, którego dzieci są leniwymi
+// kopiami dzieci źródła, więc kopiujemy naraz tylko jeden poziom (dzieci
+// źródła bez własnych dzieci kopiujemy od razu jako zwykłe). Robimy
+// to przy pierwszym dostępie do dzieci (pod mutexem, bo mogą to robić
+// jednocześnie czytelnicy i czytający ze snapshotów); materializacja nie
+// zmienia logicznej zawartości wierzchołka, więc nie stemplujemy jej.
+// Pod mutexem kopii bierzemy tylko mutex źródła. Referencje do snapshotów
+// oddajemy bez żadnego mutexa wierzchołka, bo versions_snapshot_end bierze
+// mutexy wierzchołków z listy pod mutexem Versions.
+static void materialize(Node *node) {
+    if (__atomic_load_n(&node->source, __ATOMIC_ACQUIRE) == NULL)
+        return;
+    ptry(pthread_mutex_lock(&node->mutex));
+    Node *source = node->source;
+    LazyCopy *copy = node->copy;
+    if (source == NULL) {
+        ptry(pthread_mutex_unlock(&node->mutex));
+        return;
+    }
+    // Źródło też może być leniwą kopią, a jego materializacja może skończyć
+    // inny snapshot, więc robimy ją bez mutexa. Żeby w tym czasie ktoś,
+    // kto zmaterializuje node, nie skończył snapshotu, w którym źródło jest
+    // osiągalne (i źródło nie zostało zwolnione), bierzemy na niego
+    // dodatkową referencję.
+    __atomic_add_fetch(&copy->refs, 1, __ATOMIC_RELAXED);
+    ptry(pthread_mutex_unlock(&node->mutex));
+    materialize(source);
+    ptry(pthread_mutex_lock(&node->mutex));
+    // Tymczasem ktoś inny mógł już zmaterializować node.
+    bool materialized = node->source != NULL;
+    if (materialized) {
+        ptry(pthread_mutex_lock(&source->mutex));
+        Children *children = children_at(source, copy->version);
+        Name key;
+        void *value;
+        char name[MAX_FOLDER_NAME_LENGTH + 1];
+        for (ChildrenIterator it = children_iterator(children);
+             children_next(children, &it, &key, &value);) {
+            name_to_string(key, name);
+            Node *child = empty_at(value, copy->version) ?
+                          node_alloc(node, node->height + 1) :
+                          lazy_new(value, copy, node, node->height + 1);
+            children_insert(&node->children, name, child);
+        }
+        ptry(pthread_mutex_unlock(&source->mutex));
+        node->copy = NULL;
+        __atomic_store_n(&node->source, NULL, __ATOMIC_RELEASE);
+    }
+    ptry(pthread_mutex_unlock(&node->mutex));
+    if (materialized)
+        lazy_release(copy, true);
+    lazy_release(copy, true);
+}
+
+// Materializuje w głąb co najwyżej *budget wierzchołków świeżej kopii.
+// Kopii nikt jeszcze nie widzi, więc jej dzieci czytamy bez mutexów.
+static void materialize_eager(Node *node, size_t *budget) {
+    if (*budget == 0 || node->source == NULL)
+        return;
+    (*budget)--;
+    materialize(node);
+    Name key;
+    void *value;
+    for (ChildrenIterator it = children_iterator(&node->children);
+         children_next(&node->children, &it, &key, &value);)
+        materialize_eager(value, budget);
+}
+
+Node *node_copy_at(Versions *v, Node *source, uint64_t version,
+                   Node *father) {
+    LazyCopy *copy = malloc(sizeof(LazyCopy));
+    if (copy == NULL)
+        fatal("Memory allocation failed");
+    copy->versions = v;
+    copy->version = version;
+    copy->refs = 0;
+    Node *node = lazy_new(source, copy, father, get_height(father) + 1);
+    // Małe poddrzewa kopiujemy od razu, więc ich snapshot kończy się tutaj
+    // i nie trzyma historii ani usuniętych wierzchołków.
+    size_t budget = COPY_EAGER_NODES;
+    materialize_eager(node, &budget);
+    stamp_new(v, node);
+    return node;
+}
+
 void node_free(Node *node) {
-    const char *child_name;
+    Name child_name;
     Node *child;
     ptry(pthread_mutex_lock(&node->mutex));
     // Rekurencyjnie zwalniamy wszystkie dzieci, pod mutexem dla pewności
-    for (HashMapIterator it = hmap_iterator(node->children);
-            hmap_next(node->children, &it,
-                      &child_name, (void **) &child);
+    for (ChildrenIterator it = children_iterator(&node->children);
+            children_next(&node->children, &it,
+                          &child_name, (void **) &child);
             node_free(child));
-    hmap_free(node->children);
+    children_free(&node->children);
+    // Leniwa kopia może zostać niezmaterializowana tylko, gdy zwalniamy
+    // całe drzewo (usuwane wierzchołki są puste, a żeby to sprawdzić,
+    // trzeba je zmaterializować).
+    if (node->copy)
+        lazy_release(node->copy, false);
+    if (node->history) {
+        while (node->history->versions) {
+            ChildrenVersion *version = node->history->versions;
+            node->history->versions = version->next;
+            children_free(&version->children);
+            free(version);
+        }
+        free(node->history);
+    }
     ptry(pthread_mutex_unlock(&node->mutex));
     ptry(pthread_cond_destroy(&node->writelock));
     ptry(pthread_cond_destroy(&node->readlock));
@@ -100,33 +356,137 @@ Node *get_node(Node *root, const char *path) {
     char component[MAX_FOLDER_NAME_LENGTH + 1];
     Node *current = root;
     while ((subpath = split_path(subpath, component))) {
-        if ((current = hmap_get(current->children, component)) == NULL)
+        if ((current = children_get(get_children(current), component)) == NULL)
             return NULL;
     }
     return current;
 }
 
+static bool satisfied(int *state, bool positive) {
+    int value = __atomic_load_n(state, __ATOMIC_RELAXED);
+    return positive ? value > 0 : value == 0;
+}
+
+static void set_state(int *state, int value) {
+    __atomic_store_n(state, value, __ATOMIC_RELAXED);
+}
+
+#ifdef TREE_SPIN
+// Maksymalna liczba obrotów przed zaśnięciem. Sekcje krytyczne są krótsze
+// niż uśpienie i obudzenie wątku, więc może się opłacać chwilę poczekać
+// aktywnie, ale na jednym procesorze nie ma to sensu.
+#define SPIN_MAX 1000
+
+// Średnią liczbę obrotów trzymamy w stałym przecinku, żeby krok 1/8 różnicy
+// nie zaokrąglał się do zera, gdy różnica jest mniejsza niż 8 obrotów.
+#define SPIN_SCALE 16
+
+#if defined(__x86_64__) || defined(__i386__)
+#define cpu_relax() __builtin_ia32_pause()
+#elif defined(__aarch64__)
+#define cpu_relax() __asm__ __volatile__("yield")
+#else
+#define cpu_relax() ((void) 0)
+#endif
+
+static int spin_max;
+static pthread_once_t spin_once = PTHREAD_ONCE_INIT;
+
+static void spin_init(void) {
+    spin_max = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? SPIN_MAX : 0;
+}
+
+// Kręci się bez mutexa wierzchołka, dopóki *state nie spełni warunku albo
+// nie minie limit obrotów. Limit dostosowuje się do tego, jak długo ostatnio
+// czekano na tym wierzchołku (podobnie jak w adaptacyjnych mutexach glibc):
+// kręcimy się do dwóch razy dłużej niż średnio trwało udane czekanie,
+// a jeśli czekający i tak zasypiają, to coraz krócej. Wymaga mutexa
+// wierzchołka i kończy się z nim.
+static void spin_for(Node *node, int *state, bool positive) {
+    ptry(pthread_once(&spin_once, spin_init));
+    if (spin_max == 0)
+        return;
+    int spin = __atomic_load_n(&node->spin, __ATOMIC_RELAXED);
+    int max = 2 * spin / SPIN_SCALE + 10;
+    if (max > spin_max)
+        max = spin_max;
+    ptry(pthread_mutex_unlock(&node->mutex));
+    int count = 0;
+    while (count < max && !satisfied(state, positive)) {
+        cpu_relax();
+        count++;
+    }
+    // Nieudane kręcenie się liczymy jako zero obrotów
+    if (count == max)
+        count = 0;
+    __atomic_store_n(&node->spin, spin + (count * SPIN_SCALE - spin) / 8,
+                     __ATOMIC_RELAXED);
+    ptry(pthread_mutex_lock(&node->mutex));
+}
+#endif
+
+// Czeka, aż *state (rstate lub wstate wierzchołka) będzie dodatni (jeśli
+// positive) albo zerowy. Wymaga mutexa wierzchołka; tak jak
+// pthread_cond_wait oddaje go na czas czekania. Śpi na cond, zwiększając
+// licznik śpiących *sleepers, żeby oddający locki budzili tylko wtedy, gdy
+// ktoś śpi. Z TREE_SPIN najpierw kręci się chwilę bez mutexa (spin_for).
+static void wait_for(Node *node, int *state, bool positive,
+                     pthread_cond_t *cond, int *sleepers) {
+    if (satisfied(state, positive))
+        return;
+#ifdef TREE_SPIN
+    spin_for(node, state, positive);
+#endif
+    while (!satisfied(state, positive)) {
+        (*sleepers)++;
+        ptry(pthread_cond_wait(cond, &node->mutex));
+        (*sleepers)--;
+    }
+}
+
 void get_readlock(Node *current) {
     if (current == NULL)
         return;
+    bool waited = false;
     ptry(pthread_mutex_lock(&current->mutex));
     // Jeśli komuś jest przekazana sekcja krytyczna, czekamy, aż ją przejmie
-    while (current->rstate > 0)
-        ptry(pthread_cond_wait(&current->rprio, &current->mutex));
+    if (current->rstate > 0) {
+        TRACE(TRACE_READ_WAIT, current, NULL);
+        waited = true;
+    }
+    wait_for(current, &current->rstate, false, &current->rprio,
+             &current->rpsleep);
     // Jeśli pisarz jest w czytelni lub niedługo będzie, to czekamy
     if (current->wrun + current->wwait + current->wstate > 0) {
+        if (!waited) {
+            TRACE(TRACE_READ_WAIT, current, NULL);
+            waited = true;
+        }
         current->rwait++;
         // Czekamy na podniesienie semafora
-        while (current->rstate == 0)
-            ptry(pthread_cond_wait(&current->readlock, &current->mutex));
-        current->rstate--;
+        wait_for(current, &current->rstate, true, &current->readlock,
+                 &current->rsleep);
+        set_state(&current->rstate, current->rstate - 1);
         current->rwait--;
         // Jeśli semafor jest już pusty, to budzimy procesy czekające na niego.
-        if (current->rstate == 0)
+        if (current->rstate == 0 && current->rpsleep > 0)
             ptry(pthread_cond_broadcast(&current->rprio));
     }
     current->rrun++;
     ptry(pthread_mutex_unlock(&current->mutex));
+    TRACE(waited ? TRACE_READ_GRANT : TRACE_READ_ACQUIRE, current, NULL);
+}
+
+bool try_readlock(Node *current) {
+    ptry(pthread_mutex_lock(&current->mutex));
+    bool available = current->rstate == 0 &&
+                     current->wrun + current->wwait + current->wstate == 0;
+    if (available)
+        current->rrun++;
+    ptry(pthread_mutex_unlock(&current->mutex));
+    if (available)
+        TRACE(TRACE_READ_ACQUIRE, current, NULL);
+    return available;
 }
 
 void release_readlock(Node *current) {
@@ -140,12 +500,16 @@ void release_readlock(Node *current) {
         current->rstate == 0 && current->wstate == 0) {
         // Jeśli czekają pisarze, to pisarza
         if (current->wwait > 0) {
-            current->wstate = 1;
-            ptry(pthread_cond_signal(&current->writelock));
-        } else {
+            TRACE(TRACE_WRITE_HANDOFF, current, NULL);
+            set_state(&current->wstate, 1);
+            if (current->wsleep > 0)
+                ptry(pthread_cond_signal(&current->writelock));
+        } else if (current->rwait > 0) {
             // A jeśli nie, to czytelników
-            current->rstate = current->rwait;
-            ptry(pthread_cond_broadcast(&current->readlock));
+            TRACE(TRACE_READ_HANDOFF, current, NULL);
+            set_state(&current->rstate, current->rwait);
+            if (current->rsleep > 0)
+                ptry(pthread_cond_broadcast(&current->readlock));
         }
     }
     ptry(pthread_mutex_unlock(&current->mutex));
@@ -181,7 +545,7 @@ bool start_read(Node *root, const char *path) {
     while ((subpath = split_path(subpath, component))) {
         // Dostajemy readlocka, począwszy od roota
         get_readlock(node);
-        Node *new = hmap_get(node->children, component);
+        Node *new = children_get(get_children(node), component);
         if (new == NULL) {
             // Jeśli nie ma takiego wierzchołka, musimy oddać readlocki
             // i o tym powiadomić wołającego
@@ -201,27 +565,37 @@ bool start_read(Node *root, const char *path) {
 bool get_writelock(Node *current) {
     if (current == NULL)
         return false;
+    bool waited = false;
     ptry(pthread_mutex_lock(&current->mutex));
     // Jeśli semafor jest podniesiony, czekamy, aż ktoś przez niego przejdzie
-    while (current->wstate > 0)
-        ptry(pthread_cond_wait(&current->wprio, &current->mutex));
+    if (current->wstate > 0) {
+        TRACE(TRACE_WRITE_WAIT, current, NULL);
+        waited = true;
+    }
+    wait_for(current, &current->wstate, false, &current->wprio,
+             &current->wpsleep);
     // Jeśli ktoś jest w czytelni (lub już ma wejść, pisarz nie wejdzie teraz,
     // bo czekaliśmy na wstate = 0), to czekamy
     if (current->rrun + current->wrun + current->rstate > 0) {
+        if (!waited) {
+            TRACE(TRACE_WRITE_WAIT, current, NULL);
+            waited = true;
+        }
         current->wwait++;
-        while (current->wstate == 0)
-            ptry(pthread_cond_wait(&current->writelock, &current->mutex));
-        current->wstate--;
+        wait_for(current, &current->wstate, true, &current->writelock,
+                 &current->wsleep);
+        set_state(&current->wstate, current->wstate - 1);
         current->wwait--;
         // Zmniejszamy stan semafora i jeśli go wyzerowaliśmy, budzimy
         // czekających na to pisarzy.
-        if (current->wstate == 0)
+        if (current->wstate == 0 && current->wpsleep > 0)
             ptry(pthread_cond_broadcast(&current->wprio));
     }
     // Ze względu na semantykę to się musi wykonać, zanim do mutexa
     // wejdą procesy z broadcasta na wprio.
     current->wrun++;
     ptry(pthread_mutex_unlock(&current->mutex));
+    TRACE(waited ? TRACE_WRITE_GRANT : TRACE_WRITE_ACQUIRE, current, NULL);
     return true;
 }
 
@@ -234,12 +608,16 @@ void release_writelock(Node *current) {
         current->rstate == 0 && current->wstate == 0) {
         // Jeśli czekają czytelnicy, to wszystkich czytelników
         if (current->rwait > 0) {
-            current->rstate = current->rwait;
-            ptry(pthread_cond_broadcast(&current->readlock));
+            TRACE(TRACE_READ_HANDOFF, current, NULL);
+            set_state(&current->rstate, current->rwait);
+            if (current->rsleep > 0)
+                ptry(pthread_cond_broadcast(&current->readlock));
         } else if (current->wwait > 0) {
             // A jeśli nie, to pisarza (o ile jakiś czeka)
-            current->wstate = 1;
-            ptry(pthread_cond_signal(&current->writelock));
+            TRACE(TRACE_WRITE_HANDOFF, current, NULL);
+            set_state(&current->wstate, 1);
+            if (current->wsleep > 0)
+                ptry(pthread_cond_signal(&current->writelock));
         }
     }
     ptry(pthread_mutex_unlock(&current->mutex));
@@ -262,7 +640,7 @@ bool start_write(Node *root, const char *path1, const char *path2) {
     while ((subpath1 = split_path(subpath1, component1))) {
         // Zdobywamy readlocki na pierwszej ścieżce
         get_readlock(node1);
-        Node *new1 = hmap_get(node1->children, component1);
+        Node *new1 = children_get(get_children(node1), component1);
         if (new1 == NULL) {
             // Tak samo, jak przy czytaniu: oddajemy, jeśli nie znaleźliśmy
             release_held_readlocks(node1, node1);
@@ -273,7 +651,7 @@ bool start_write(Node *root, const char *path1, const char *path2) {
         // ale nie zdobywamy żadnych locków
         if (node1 == node2) {
             subpath2 = split_path(subpath2, component2);
-            if ((node2 = hmap_get(node2->children, component2)) == NULL) {
+            if ((node2 = children_get(get_children(node2), component2)) == NULL) {
                 release_held_readlocks(node1, node1);
                 return false;
             }
@@ -297,7 +675,7 @@ bool start_write(Node *root, const char *path1, const char *path2) {
             ptry(pthread_mutex_unlock(&node2->mutex));
         } else
             get_readlock(node2);
-        Node *new = hmap_get(node2->children, component2);
+        Node *new = children_get(get_children(node2), component2);
         if (new == NULL) {
             release_writelock(node1);
             release_held_readlocks(get_father(node1), node2);
@@ -319,4 +697,548 @@ void end_write(Node *node1, Node *node2) {
     if (node1 != node2)
         release_writelock(node2);
     release_held_readlocks(get_father(node1), get_father(node2));
-}
\ No newline at end of file
+}
+// Zwraca głębokość ostatniego wierzchołka wspólnego dla obu ścieżek
+// (korzeń ma głębokość 0).
+static int common_depth(const char *path1, const char *path2) {
+    int slashes = 0;
+    while (*path1 && *path1 == *path2) {
+        if (*path1 == '/')
+            slashes++;
+        path1++;
+        path2++;
+    }
+    return slashes - 1;
+}
+
+static int compare_paths(const void *p1, const void *p2) {
+    return strcmp(*(const char **) p1, *(const char **) p2);
+}
+
+void end_write_many(LockSet *locks) {
+    // Najpierw writelocki, potem readlocki w odwrotnej kolejności niż je
+    // zdobywaliśmy, czyli na każdej ścieżce od najgłębszego wierzchołka.
+    for (size_t i = locks->n_write; i-- > 0;)
+        release_writelock(locks->write[i]);
+    for (size_t i = locks->n_read; i-- > 0;)
+        release_readlock(locks->read[i]);
+    free(locks->read);
+    free(locks->write);
+    free(locks->paths);
+    locks->read = locks->write = NULL;
+    locks->paths = NULL;
+    locks->n_read = locks->n_write = locks->n_paths = 0;
+}
+
+bool start_write_many(Node *root, const char **paths, size_t n,
+                      LockSet *locks) {
+    // Sortujemy ścieżki i zostawiamy tylko te, które nie mają innej ścieżki
+    // ze zbioru jako prefiksu: writelock na przodku daje wyłączny dostęp do
+    // całego poddrzewa, bo każdy, kto chce do niego wejść, potrzebuje na
+    // przodku readlocka. Po posortowaniu prefiks danej ścieżki, jeśli jest,
+    // to jest ostatnią zostawioną ścieżką.
+    const char **sorted = malloc(n * sizeof(char *));
+    if (sorted == NULL && n > 0)
+        fatal("Memory allocation failed");
+    memcpy(sorted, paths, n * sizeof(char *));
+    qsort(sorted, n, sizeof(char *), compare_paths);
+    size_t kept = 0, max_read = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (kept > 0 && strncmp(sorted[kept - 1], sorted[i],
+                                strlen(sorted[kept - 1])) == 0)
+            continue;
+        sorted[kept++] = sorted[i];
+        for (const char *c = sorted[i]; *c; c++)
+            max_read += *c == '/';
+    }
+    locks->paths = sorted;
+    locks->n_paths = kept;
+    locks->read = malloc((max_read + 1) * sizeof(Node *));
+    locks->write = malloc((kept + 1) * sizeof(Node *));
+    if (locks->read == NULL || locks->write == NULL)
+        fatal("Memory allocation failed");
+    locks->n_read = locks->n_write = 0;
+    locks->failed = NULL;
+    char component[MAX_FOLDER_NAME_LENGTH + 1];
+    for (size_t i = 0; i < kept; i++) {
+        // Wierzchołki do głębokości shared mamy już zablokowane do czytania
+        // przy poprzedniej ścieżce (żadna ścieżka nie jest prefiksem innej,
+        // więc leżą one ściśle nad poprzednim celem), a niżej zdobywamy
+        // readlocki tak jak w start_write, w kolejności leksykograficznej.
+        int shared = i == 0 ? -1 : common_depth(sorted[i - 1], sorted[i]);
+        Node *node = root;
+        int depth = 0;
+        const char *subpath = sorted[i];
+        while ((subpath = split_path(subpath, component))) {
+            if (depth > shared) {
+                get_readlock(node);
+                locks->read[locks->n_read++] = node;
+            }
+            Node *new = children_get(get_children(node), component);
+            if (new == NULL) {
+                locks->failed = sorted[i];
+                end_write_many(locks);
+                return false;
+            }
+            set_height(new, depth + 2);
+            node = new;
+            depth++;
+        }
+        get_writelock(node);
+        locks->write[locks->n_write++] = node;
+    }
+    return true;
+}
+
+Versions *versions_new(void) {
+    Versions *v = malloc(sizeof(Versions));
+    if (v == NULL)
+        fatal("Memory allocation failed");
+    ptry(pthread_mutex_init(&v->begin_mutex, 0));
+    ptry(pthread_mutex_init(&v->mutex, 0));
+    ptry(pthread_mutex_init(&v->dirty_mutex, 0));
+    v->clock = 0;
+    v->writers[0] = v->writers[1] = 0;
+    v->active = NULL;
+    v->n_active = v->active_capacity = 0;
+    v->newest = 0;
+    v->retired = NULL;
+    v->dirty = NULL;
+    return v;
+}
+
+void versions_free(Versions *v) {
+    while (v->retired) {
+        Retired *r = v->retired;
+        v->retired = r->next;
+        node_free(r->node);
+        free(r);
+    }
+    ptry(pthread_mutex_destroy(&v->dirty_mutex));
+    ptry(pthread_mutex_destroy(&v->mutex));
+    ptry(pthread_mutex_destroy(&v->begin_mutex));
+    free(v->active);
+    free(v);
+}
+
+void versions_write_begin(Versions *v) {
+    // Jeśli między odczytaniem zegara a zgłoszeniem się zaczął snapshot,
+    // to mógł już nie zauważyć zgłoszenia, więc próbujemy z nową epoką.
+    uint64_t epoch = __atomic_load_n(&v->clock, __ATOMIC_SEQ_CST);
+    while (true) {
+        __atomic_add_fetch(&v->writers[epoch & 1], 1, __ATOMIC_SEQ_CST);
+        uint64_t now = __atomic_load_n(&v->clock, __ATOMIC_SEQ_CST);
+        if (now == epoch)
+            break;
+        __atomic_sub_fetch(&v->writers[epoch & 1], 1, __ATOMIC_RELEASE);
+        epoch = now;
+    }
+    write_epoch = epoch;
+}
+
+static void collect(Versions *v);
+
+void versions_write_end(Versions *v) {
+    __atomic_sub_fetch(&v->writers[write_epoch & 1], 1, __ATOMIC_RELEASE);
+    // Jeśli ostatni snapshot skończył się w trakcie sekcji, to mógł przyciąć
+    // historię, zanim dodaliśmy swoją, i nikt jej nie zwolni aż do końca
+    // następnego snapshotu, więc robimy to sami.
+    if (write_history && __atomic_load_n(&v->newest, __ATOMIC_ACQUIRE) == 0) {
+        ptry(pthread_mutex_lock(&v->mutex));
+        if (v->n_active == 0)
+            collect(v);
+        ptry(pthread_mutex_unlock(&v->mutex));
+    }
+    write_history = false;
+}
+
+uint64_t versions_snapshot_begin(Versions *v) {
+    ptry(pthread_mutex_lock(&v->begin_mutex));
+    ptry(pthread_mutex_lock(&v->mutex));
+    uint64_t version = v->clock + 1;
+    if (v->n_active == v->active_capacity) {
+        v->active_capacity = v->active_capacity ? 2 * v->active_capacity : 4;
+        v->active = realloc(v->active, v->active_capacity * sizeof(uint64_t));
+        if (v->active == NULL)
+            fatal("Memory allocation failed");
+    }
+    // Wersje rosną, więc tablica pozostaje posortowana.
+    v->active[v->n_active++] = version;
+    __atomic_store_n(&v->newest, version, __ATOMIC_RELEASE);
+    ptry(pthread_mutex_unlock(&v->mutex));
+    __atomic_store_n(&v->clock, version, __ATOMIC_SEQ_CST);
+    // Pisarze z epoki version - 1 stemplują zmiany wersją snapshotu, więc
+    // czekamy, aż skończą. Nowi pisarze mają już nowszą epokę, a wcześniejsze
+    // epoki skończyły się przed początkiem poprzedniego snapshotu. Sekcje
+    // krytyczne nie czekają na locki drzewa, więc czekamy krótko.
+    while (__atomic_load_n(&v->writers[(version - 1) & 1],
+                           __ATOMIC_SEQ_CST) != 0)
+        sched_yield();
+    ptry(pthread_mutex_unlock(&v->begin_mutex));
+    return version;
+}
+
+// Czy jakiś aktywny snapshot ma wersję z przedziału [from, to). Wymaga
+// mutexa Versions.
+static bool is_visible(Versions *v, uint64_t from, uint64_t to) {
+    size_t lo = 0, hi = v->n_active;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (v->active[mid] < from)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo < v->n_active && v->active[lo] < to;
+}
+
+// Usuwa z historii wierzchołka wersje, których nie widzi żaden aktywny
+// snapshot, a jeśli wszystkie aktywne snapshoty widzą obecne dzieci, to
+// zwalnia całą NodeHistory i zwraca fałsz. Wymaga mutexa Versions i mutexa
+// wierzchołka.
+static bool prune_history(Versions *v, Node *node) {
+    NodeHistory *history = node->history;
+    uint64_t to = history->stamp;
+    for (ChildrenVersion **pv = &history->versions; *pv;) {
+        ChildrenVersion *version = *pv;
+        uint64_t from = version->stamp;
+        if (is_visible(v, from, to)) {
+            pv = &version->next;
+        } else {
+            *pv = version->next;
+            children_free(&version->children);
+            free(version);
+        }
+        to = from;
+    }
+    if (history->versions != NULL ||
+        (v->n_active > 0 && v->active[0] < history->stamp))
+        return true;
+    free(history);
+    node->history = NULL;
+    return false;
+}
+
+void versions_snapshot_end(Versions *v, uint64_t version) {
+    ptry(pthread_mutex_lock(&v->mutex));
+    size_t i = 0;
+    while (v->active[i] != version)
+        i++;
+    memmove(&v->active[i], &v->active[i + 1],
+            (--v->n_active - i) * sizeof(uint64_t));
+    __atomic_store_n(&v->newest, v->n_active ? v->active[v->n_active - 1] : 0,
+                     __ATOMIC_RELEASE);
+    collect(v);
+    ptry(pthread_mutex_unlock(&v->mutex));
+}
+
+// Przycina historię wierzchołków z listy i zwalnia usunięte wierzchołki,
+// których nie widzi już żaden snapshot. Wymaga mutexa Versions.
+static void collect(Versions *v) {
+    // Przycinamy historię wierzchołków z listy. Zdejmujemy całą listę, żeby
+    // nie trzymać dirty_mutex razem z mutexami wierzchołków.
+    ptry(pthread_mutex_lock(&v->dirty_mutex));
+    Node *dirty = v->dirty;
+    v->dirty = NULL;
+    ptry(pthread_mutex_unlock(&v->dirty_mutex));
+    Node *keep = NULL, *keep_last = NULL;
+    while (dirty) {
+        Node *node = dirty;
+        ptry(pthread_mutex_lock(&node->mutex));
+        dirty = node->history->next;
+        if (prune_history(v, node)) {
+            node->history->next = keep;
+            if (keep)
+                keep->history->pprev = &node->history->next;
+            keep = node;
+            if (keep_last == NULL)
+                keep_last = node;
+        }
+        ptry(pthread_mutex_unlock(&node->mutex));
+    }
+    if (keep) {
+        ptry(pthread_mutex_lock(&v->dirty_mutex));
+        keep_last->history->next = v->dirty;
+        if (v->dirty)
+            v->dirty->history->pprev = &keep_last->history->next;
+        keep->history->pprev = &v->dirty;
+        v->dirty = keep;
+        ptry(pthread_mutex_unlock(&v->dirty_mutex));
+    }
+    // Usunięte wierzchołki, których nie widzi już żaden snapshot, zwalniamy.
+    // Ich historia jest już pusta, bo jej wersje są starsze niż usunięcie.
+    uint64_t oldest = v->n_active ? v->active[0] : UINT64_MAX;
+    for (Retired **pr = &v->retired; *pr;) {
+        Retired *r = *pr;
+        if (r->stamp <= oldest && r->node->history == NULL) {
+            *pr = r->next;
+            node_free(r->node);
+            free(r);
+        } else {
+            pr = &r->next;
+        }
+    }
+}
+
+// Daje wierzchołkowi NodeHistory o podanym stemplu. Wymaga mutexa
+// wierzchołka; zwraca prawdę, bo trzeba go potem dodać do listy w Versions
+// (register_dirty).
+static bool history_new(Node *node, uint64_t stamp) {
+    NodeHistory *history = malloc(sizeof(NodeHistory));
+    if (history == NULL)
+        fatal("Memory allocation failed");
+    history->stamp = stamp;
+    history->versions = NULL;
+    history->next = NULL;
+    history->pprev = NULL;
+    node->history = history;
+    write_history = true;
+    return true;
+}
+
+// Dodaje wierzchołek do listy w Versions. Nie wymaga mutexa wierzchołka,
+// bo next zmienia tylko ten, kto trzyma listę.
+static void register_history(Versions *v, Node *node) {
+    ptry(pthread_mutex_lock(&v->dirty_mutex));
+    node->history->next = v->dirty;
+    if (v->dirty)
+        v->dirty->history->pprev = &node->history->next;
+    node->history->pprev = &v->dirty;
+    v->dirty = node;
+    ptry(pthread_mutex_unlock(&v->dirty_mutex));
+}
+
+// Przygotowuje dzieci wierzchołka do zmiany przez pisarza, który jest
+// w sekcji krytycznej Versions: jeśli obecną wersję może widzieć jakiś
+// snapshot, zamraża jej kopię. Kończy się z zablokowanym mutexem wierzchołka
+// i zwraca, czy trzeba dodać wierzchołek do listy w Versions.
+static bool modify_begin(Versions *v, Node *node) {
+    uint64_t stamp = write_epoch + 1;
+    uint64_t newest = __atomic_load_n(&v->newest, __ATOMIC_ACQUIRE);
+    bool register_dirty = false;
+    materialize(node);
+    ptry(pthread_mutex_lock(&node->mutex));
+    // Obecną wersję widzą snapshoty o wersjach od jej stempla, więc jeśli
+    // najnowszy jest starszy (w szczególności, gdy wierzchołek powstał po
+    // nim), to nie ma czego zamrażać. Jeśli stamp jest równy obecnemu, to
+    // obecnej wersji też nie widzi żaden snapshot, bo powstała już po
+    // ostatnim z nich.
+    uint64_t current = node->history ? node->history->stamp : 0;
+    if (current < stamp && newest != 0 && newest >= current) {
+        if (node->history == NULL)
+            register_dirty = history_new(node, current);
+        ChildrenVersion *version = malloc(sizeof(ChildrenVersion));
+        if (version == NULL)
+            fatal("Memory allocation failed");
+        children_copy(&version->children, &node->children);
+        version->stamp = current;
+        version->next = node->history->versions;
+        node->history->versions = version;
+    }
+    // Bez NodeHistory wierzchołek zostaje tylko, gdy nie ma snapshotów, a te,
+    // które się zaczną, zobaczą obecną wersję.
+    if (node->history)
+        node->history->stamp = stamp;
+    return register_dirty;
+}
+
+static void modify_end(Versions *v, Node *node, bool register_dirty) {
+    ptry(pthread_mutex_unlock(&node->mutex));
+    if (register_dirty)
+        register_history(v, node);
+}
+
+bool node_insert_child(Versions *v, Node *node, const char *name,
+                       Node *child) {
+    bool register_dirty = modify_begin(v, node);
+    bool result = children_insert(&node->children, name, child);
+    modify_end(v, node, register_dirty);
+    return result;
+}
+
+bool node_remove_child(Versions *v, Node *node, const char *name) {
+    bool register_dirty = modify_begin(v, node);
+    bool result = children_remove(&node->children, name);
+    modify_end(v, node, register_dirty);
+    return result;
+}
+
+bool node_rename_child(Versions *v, Node *node, const char *name,
+                       const char *new_name) {
+    bool register_dirty = modify_begin(v, node);
+    bool result = children_rename(&node->children, name, new_name);
+    modify_end(v, node, register_dirty);
+    return result;
+}
+
+// Stempluje wierzchołek stworzony w sekcji krytycznej pisarza, jeśli trwają
+// jakieś snapshoty: żaden z nich go nie widzi, więc jego zmiany nie muszą
+// zamrażać kopii dzieci.
+static void stamp_new(Versions *v, Node *node) {
+    if (__atomic_load_n(&v->newest, __ATOMIC_ACQUIRE) == 0)
+        return;
+    history_new(node, write_epoch + 1);
+    register_history(v, node);
+}
+
+Node *node_create(Versions *v, Node *father) {
+    Node *node = node_new(father);
+    stamp_new(v, node);
+    return node;
+}
+
+void node_retire(Versions *v, Node *node) {
+    ptry(pthread_mutex_lock(&v->mutex));
+    // Snapshot, który powstanie po tej sekcji krytycznej, już go nie zobaczy,
+    // więc jeśli nie widzi go żaden z obecnych, można go od razu zwolnić.
+    // Tak jest, gdy nie ma snapshotów albo gdy wierzchołek nie ma starszych
+    // wersji, a obecną zmieniono (lub wierzchołek stworzono) po najnowszym
+    // snapshocie — w szczególności tak jest z wierzchołkami tworzonymi
+    // i usuwanymi, gdy snapshot trzyma niezmaterializowana kopia.
+    NodeHistory *history = node->history;
+    if (history == NULL ? v->n_active == 0 :
+        history->versions == NULL &&
+        (v->n_active == 0 || v->active[v->n_active - 1] < history->stamp)) {
+        // Wierzchołek z NodeHistory jest na liście w Versions. Nie zmienia
+        // jej teraz versions_snapshot_end, bo trzymamy mutex Versions.
+        if (history) {
+            ptry(pthread_mutex_lock(&v->dirty_mutex));
+            *history->pprev = history->next;
+            if (history->next)
+                history->next->history->pprev = history->pprev;
+            ptry(pthread_mutex_unlock(&v->dirty_mutex));
+        }
+        ptry(pthread_mutex_unlock(&v->mutex));
+        node_free(node);
+        return;
+    }
+    Retired *r = malloc(sizeof(Retired));
+    if (r == NULL)
+        fatal("Memory allocation failed");
+    r->node = node;
+    r->stamp = write_epoch + 1;
+    r->next = v->retired;
+    v->retired = r;
+    write_history = true;
+    ptry(pthread_mutex_unlock(&v->mutex));
+}
+
+// Zwraca wersję dzieci wierzchołka widoczną w snapshocie o podanej wersji.
+// Wymaga mutexa wierzchołka.
+static Children *children_at(Node *node, uint64_t version) {
+    if (node->history == NULL || node->history->stamp <= version)
+        return &node->children;
+    for (ChildrenVersion *v = node->history->versions; v; v = v->next) {
+        if (v->stamp <= version)
+            return &v->children;
+    }
+    return NULL;
+}
+
+Node *node_child_at(Node *node, const char *name, uint64_t version) {
+    materialize(node);
+    ptry(pthread_mutex_lock(&node->mutex));
+    Children *children = children_at(node, version);
+    Node *child = children ? children_get(children, name) : NULL;
+    ptry(pthread_mutex_unlock(&node->mutex));
+    return child;
+}
+
+Node *get_node_at(Node *root, const char *path, uint64_t version) {
+    const char *subpath = path;
+    char component[MAX_FOLDER_NAME_LENGTH + 1];
+    Node *current = root;
+    while (current && (subpath = split_path(subpath, component)))
+        current = node_child_at(current, component, version);
+    return current;
+}
+
+char *node_list_at(Node *node, uint64_t version) {
+    materialize(node);
+    ptry(pthread_mutex_lock(&node->mutex));
+    Children *children = children_at(node, version);
+    Children empty;
+    children_init(&empty);
+    char *result = make_children_string(children ? children : &empty);
+    ptry(pthread_mutex_unlock(&node->mutex));
+    return result;
+}
+
+// Rozmiar obiektów synchronizacji wierzchołka
+#define SYNC_BYTES (sizeof(pthread_mutex_t) + 4 * sizeof(pthread_cond_t))
+
+void node_memory_usage(Node *node, TreeMemoryUsage *usage) {
+    // Dzieci kopiujemy pod mutexem, a schodzimy do nich już bez niego.
+    // Readlock gwarantuje, że nikt ich w tym czasie nie usunie.
+    ptry(pthread_mutex_lock(&node->mutex));
+    usage->folders++;
+    usage->node_bytes += malloc_usable_size(node) - SYNC_BYTES;
+    usage->sync_bytes += SYNC_BYTES;
+    usage->children_bytes += children_memory(&node->children);
+    if (node->history) {
+        usage->history_bytes += malloc_usable_size(node->history);
+        for (ChildrenVersion *v = node->history->versions; v; v = v->next) {
+            usage->history_bytes += malloc_usable_size(v) +
+                                    children_memory(&v->children);
+        }
+    }
+    size_t n = children_size(&node->children);
+    Node **children = malloc(n * sizeof(Node *) + 1);
+    if (children == NULL)
+        fatal("Memory allocation failed");
+    Name key;
+    size_t i = 0;
+    for (ChildrenIterator it = children_iterator(&node->children);
+         children_next(&node->children, &it, &key, (void **) &children[i]);
+         i++);
+    ptry(pthread_mutex_unlock(&node->mutex));
+    for (i = 0; i < n; i++) {
+        get_readlock(children[i]);
+        node_memory_usage(children[i], usage);
+        release_readlock(children[i]);
+    }
+    free(children);
+}
+
+// Przenosi wierzchołek do świeżo zaalokowanej struktury. Wołane przez
+// children_rebuild pod writelockiem ojca, więc nikt poza nami nie ma
+// dostępu do wierzchołka ani jego poddrzewa. Pomijamy wierzchołki, na które
+// mogą wskazywać leniwe kopie i lista w Versions.
+static void *relocate(void *value, void *arg) {
+    (void) arg;
+    Node *old = value;
+    if (old->source || old->history)
+        return old;
+    Node *n = node_alloc(old->father, old->height);
+    n->children = old->children;
+    Name key;
+    void *child;
+    for (ChildrenIterator it = children_iterator(&n->children);
+         children_next(&n->children, &it, &key, &child);)
+        set_father(child, n);
+    ptry(pthread_cond_destroy(&old->writelock));
+    ptry(pthread_cond_destroy(&old->readlock));
+    ptry(pthread_cond_destroy(&old->rprio));
+    ptry(pthread_cond_destroy(&old->wprio));
+    ptry(pthread_mutex_destroy(&old->mutex));
+    free(old);
+    return n;
+}
+
+bool node_compact(Versions *v, Node *node) {
+    if (__atomic_load_n(&node->source, __ATOMIC_ACQUIRE) != NULL)
+        return false;
+    // Nowy snapshot może się zacząć, ale zanim zacznie czytać, poczeka na
+    // koniec naszej sekcji krytycznej, a skończyć się może, co nam nie
+    // przeszkadza.
+    ptry(pthread_mutex_lock(&v->mutex));
+    bool move = v->n_active == 0;
+    ptry(pthread_mutex_unlock(&v->mutex));
+    ptry(pthread_mutex_lock(&node->mutex));
+    // Stare wersje dzieci też wskazują na dzieci, więc z historią nie
+    // przenosimy (zostaje po snapshotach tylko do najbliższego przycięcia).
+    children_rebuild(&node->children,
+                     move && node->history == NULL ? relocate : NULL, NULL);
+    ptry(pthread_mutex_unlock(&node->mutex));
+    return true;
+}
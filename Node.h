@@ -2,8 +2,11 @@
 
 #include "err.h"
 #include <pthread.h>
+#include <stdint.h>
 // dla stdbool.h
 #include "path_utils.h"
+#include "Children.h"
+#include "Tree.h"
 
 // Makro do wykonywania funkcji z biblioteki pthreads z jednoczesnym
 // sprawdzeniem kodu błędu. W przypadku ustawienia flagi NDEBUG na fałsz
@@ -23,8 +26,8 @@ typedef struct Node Node;
 // Ustawia pierwszemu wierzchołkowi atrybut rodzica na drugi wierzchołek.
 void set_father(Node *node, Node *father);
 
-// Zwraca hashmapę reprezentującą dzieci danego wierzchołka.
-HashMap *get_children(Node *);
+// Zwraca zbiór dzieci danego wierzchołka.
+Children *get_children(Node *);
 
 // Stworzenie nowego wierzchołka o podanym ojcu
 Node *node_new(Node *);
@@ -37,6 +40,17 @@ void node_free(Node *);
 // na ścieżce z korzenia do wynikowego wierzchołka.
 Node *get_node(Node *root, const char *);
 
+// Dostaje status czytelnika w podanym wierzchołku. Uwaga: wymaga, żeby
+// proces wołający był już czytelnikiem w jego ojcu (i tak aż do korzenia).
+void get_readlock(Node *);
+
+// Jak get_readlock, ale tylko jeśli nie trzeba by czekać (w wierzchołku nie
+// ma pisarza ani nikt na niego nie czeka). Zwraca, czy zdobyło status.
+bool try_readlock(Node *);
+
+// Oddaje status czytelnika w podanym wierzchołku (ale nie w jego przodkach).
+void release_readlock(Node *);
+
 // Oddaje status czytelnika na wszystkich wierzchołkach na ścieżce od dwóch
 // podanych wierzchołków do korzenia (jeśli się pokrywają, to oddaje tylko
 // raz, w szczególności release_held_readlocks(node, node) oddaje readlock
@@ -56,4 +70,114 @@ bool start_write(Node *root, const char *, const char *);
 // Kończy pisanie w podanych wierzchołkach, tj oddaje w nich status pisarza
 // i wszystkie statusy czytelnika w wierzchołkach na ścieżkach od ich ojców
 // do korzenia.
-void end_write(Node *, Node *);
\ No newline at end of file
+void end_write(Node *, Node *);
+
+// Locki zdobyte przez start_write_many.
+typedef struct LockSet {
+    // Wierzchołki, w których mamy status czytelnika, i te, w których mamy
+    // status pisarza, w kolejności zdobywania
+    Node **read, **write;
+    size_t n_read, n_write;
+    // Posortowane ścieżki, na których faktycznie mamy writelocki
+    const char **paths;
+    size_t n_paths;
+    // Jeśli start_write_many się nie powiodło, to ścieżka, która nie istnieje
+    const char *failed;
+} LockSet;
+
+// Uogólnienie start_write na dowolnie wiele ścieżek. Z podanych ścieżek
+// wybiera minimalny zbiór: pomija te, które mają przodka w zbiorze, bo
+// writelock na przodku i tak daje wyłączny dostęp do jego poddrzewa.
+// Na pozostałych zdobywa status pisarza, a na ich przodkach status
+// czytelnika, w kolejności leksykograficznej ścieżek, tak jak start_write.
+// Jeśli któraś z wybranych ścieżek nie istnieje, oddaje zdobyte locki,
+// ustawia locks->failed na tę ścieżkę i zwraca fałsz. Napisy ścieżek
+// muszą być ważne do wywołania end_write_many.
+bool start_write_many(Node *root, const char **paths, size_t n,
+                      LockSet *locks);
+
+// Oddaje wszystkie locki zdobyte przez start_write_many.
+void end_write_many(LockSet *locks);
+
+// Rejestr wersji drzewa, pozwalający czytać je w postaci z chwili początku
+// snapshotu bez brania locków. Pisarze zamrażają kopię dzieci wierzchołka
+// przy jego pierwszej zmianie po początku snapshotu (chyba że wierzchołek
+// powstał później niż wszystkie snapshoty), a usunięte wierzchołki
+// zwalniają dopiero, gdy nie widzi ich już żaden snapshot. Wierzchołki
+// płacą za to pamięcią tylko, dopóki trwają snapshoty.
+typedef struct Versions Versions;
+
+Versions *versions_new(void);
+
+// Zwalnia rejestr razem z usuniętymi wierzchołkami, na które jeszcze czekał.
+// Nie może być wtedy aktywnych snapshotów (poza trzymanymi przez leniwe
+// kopie ze zwolnionego już drzewa).
+void versions_free(Versions *);
+
+// Sekcja krytyczna pisarza (po zdobyciu writelocków): wszystkie zmiany
+// dzieci wierzchołków muszą się odbywać między tymi wywołaniami i przez
+// node_insert_child, node_remove_child i node_retire. Nie czeka na
+// snapshoty: wspólny mutex bierze tylko versions_write_end, i to tylko
+// wtedy, gdy ostatni snapshot skończył się w trakcie sekcji, a ona dodała
+// historię, którą trzeba przyciąć. W sekcji krytycznej nie wolno czekać na
+// locki drzewa ani zaczynać snapshotu.
+void versions_write_begin(Versions *);
+void versions_write_end(Versions *);
+
+// Zaczyna snapshot i zwraca jego wersję. Nie blokuje pisarzy, a czeka tylko
+// na zakończenie sekcji krytycznych, które zaczęły się przed nim.
+uint64_t versions_snapshot_begin(Versions *);
+
+// Kończy snapshot o podanej wersji i zwalnia wersje, których nie potrzebuje
+// już żaden inny snapshot.
+void versions_snapshot_end(Versions *, uint64_t);
+
+// Odpowiedniki children_insert i children_remove dla pisarza w sekcji
+// krytycznej, zachowujące starą wersję dzieci, jeśli widzi ją jakiś snapshot.
+bool node_insert_child(Versions *, Node *, const char *, Node *);
+bool node_remove_child(Versions *, Node *, const char *);
+
+// Odpowiednik children_rename dla pisarza w sekcji krytycznej.
+bool node_rename_child(Versions *, Node *, const char *, const char *);
+
+// Tak jak node_new, ale dla pisarza w sekcji krytycznej: zmiany wierzchołka
+// stworzonego w czasie trwania snapshotów nie zamrażają kopii jego dzieci,
+// bo tamte snapshoty go nie widzą.
+Node *node_create(Versions *, Node *father);
+
+// Zwalnia wierzchołek usunięty z drzewa w sekcji krytycznej pisarza od razu
+// albo, jeśli mogą go jeszcze widzieć snapshoty, po ich zakończeniu.
+void node_retire(Versions *, Node *);
+
+// Odpowiedniki children_get, get_node i make_children_string dla snapshotu
+// o podanej wersji. Nie wymagają żadnych locków (biorą tylko na chwilę
+// mutex czytanego wierzchołka), ale wierzchołki muszą być osiągalne
+// w tym snapshocie, a snapshot aktywny.
+Node *node_child_at(Node *, const char *, uint64_t);
+Node *get_node_at(Node *root, const char *, uint64_t);
+char *node_list_at(Node *, uint64_t);
+
+// Tworzy leniwą kopię wierzchołka `source` w postaci ze snapshotu o podanej
+// wersji, z ojcem `father`. Kopia przejmuje ten snapshot (wołający nie może
+// go już kończyć) i trzyma go, dopóki wszystkie jej wierzchołki nie zostaną
+// zmaterializowane. Pierwsze kilkaset wierzchołków kopiuje od razu, więc
+// kopia małego poddrzewa nie jest leniwa i kończy snapshot od razu. Dalej
+// leniwy wierzchołek kopiuje przy pierwszym dostępie do dzieci tylko jeden
+// poziom: dzieci źródła bez dzieci stają się zwykłymi pustymi
+// wierzchołkami, a pozostałe — leniwymi kopiami. Wstawienie kopii do
+// drzewa jest zwykłym node_insert_child w sekcji krytycznej pisarza.
+Node *node_copy_at(Versions *, Node *source, uint64_t version, Node *father);
+
+// Dodaje do raportu pamięć zajmowaną przez poddrzewo wierzchołka (bez
+// name_bytes i total_bytes, które liczy tree_memory_usage). Wymaga statusu
+// czytelnika w wierzchołku i jego przodkach; na potomkach zdobywa go sama.
+// Nie materializuje leniwych kopii.
+void node_memory_usage(Node *, TreeMemoryUsage *);
+
+// Przebudowuje zbiór dzieci wierzchołka w świeżej pamięci i, jeśli nie ma
+// aktywnych snapshotów, przenosi każde dziecko do nowej alokacji (osobny
+// malloc na wierzchołek).
+// Wymaga statusu pisarza w wierzchołku i sekcji krytycznej Versions.
+// Zwraca fałsz, jeśli wierzchołek jest niezmaterializowaną kopią (wtedy nie
+// ma czego przebudowywać ani w nim, ani w jego poddrzewie).
+bool node_compact(Versions *, Node *);
@@ -0,0 +1,191 @@
+#define _GNU_SOURCE
+#include "Trace.h"
+#include "Node.h"
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef TREE_TRACE
+
+// Liczba ostatnich zdarzeń pamiętanych przez każdy wątek (potęga dwójki).
+#define TRACE_BUFFER_SIZE 4096
+
+// Wszystkie pola są czytane przez tree_trace_dump równolegle z zapisem,
+// więc są zapisywane i czytane atomowo. Pole seq (numer zdarzenia + 1)
+// jest zapisywane na końcu, a przed zapisem pozostałych pól jest zerowane,
+// dzięki czemu czytający wykrywa zdarzenia nadpisane w trakcie czytania.
+typedef struct TraceEntry {
+    uint64_t seq;
+    uint64_t time;
+    const void *object;
+    const char *name;
+    int tid;
+    int type;
+} TraceEntry;
+
+typedef struct TraceBuffer {
+    TraceEntry entries[TRACE_BUFFER_SIZE];
+    // Liczba zapisanych zdarzeń, zmieniana tylko przez właściciela bufora
+    uint64_t head;
+    // Czy właściciel się zakończył i bufor może przejąć inny wątek
+    // (chronione mutexem rejestru)
+    bool orphaned;
+    struct TraceBuffer *next;
+} TraceBuffer;
+
+// Rejestr wszystkich buforów. Mutex jest brany tylko przy pierwszym
+// zdarzeniu wątku, przy jego zakończeniu i przy zrzucaniu.
+static struct {
+    pthread_mutex_t mutex;
+    TraceBuffer *buffers;
+    pthread_key_t key;
+    pthread_once_t once;
+} registry = {PTHREAD_MUTEX_INITIALIZER, NULL, 0, PTHREAD_ONCE_INIT};
+
+static __thread TraceBuffer *own_buffer;
+static __thread int own_tid;
+
+// Przy zakończeniu wątku oddajemy jego bufor do przejęcia, zamiast go
+// zwalniać, żeby jego zdarzenia można było jeszcze zrzucić.
+static void release_buffer(void *data) {
+    TraceBuffer *buffer = data;
+    ptry(pthread_mutex_lock(&registry.mutex));
+    buffer->orphaned = true;
+    ptry(pthread_mutex_unlock(&registry.mutex));
+}
+
+static void create_key(void) {
+    ptry(pthread_key_create(&registry.key, release_buffer));
+}
+
+static TraceBuffer *get_buffer(void) {
+    ptry(pthread_once(&registry.once, create_key));
+    own_tid = (int) syscall(SYS_gettid);
+    ptry(pthread_mutex_lock(&registry.mutex));
+    TraceBuffer *buffer = registry.buffers;
+    while (buffer && !buffer->orphaned)
+        buffer = buffer->next;
+    if (buffer == NULL) {
+        buffer = calloc(1, sizeof(TraceBuffer));
+        if (buffer == NULL)
+            fatal("Memory allocation failed");
+        buffer->next = registry.buffers;
+        registry.buffers = buffer;
+    }
+    buffer->orphaned = false;
+    ptry(pthread_mutex_unlock(&registry.mutex));
+    ptry(pthread_setspecific(registry.key, buffer));
+    return buffer;
+}
+
+void trace_record(TraceEvent type, const void *object, const char *name) {
+    if (own_buffer == NULL)
+        own_buffer = get_buffer();
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    TraceBuffer *buffer = own_buffer;
+    uint64_t index = buffer->head;
+    TraceEntry *e = &buffer->entries[index % TRACE_BUFFER_SIZE];
+    __atomic_store_n(&e->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&e->time, now.tv_sec * 1000000000ULL + now.tv_nsec,
+                     __ATOMIC_RELAXED);
+    __atomic_store_n(&e->object, object, __ATOMIC_RELAXED);
+    __atomic_store_n(&e->name, name, __ATOMIC_RELAXED);
+    __atomic_store_n(&e->tid, own_tid, __ATOMIC_RELAXED);
+    __atomic_store_n(&e->type, (int) type, __ATOMIC_RELAXED);
+    __atomic_store_n(&e->seq, index + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&buffer->head, index + 1, __ATOMIC_RELEASE);
+}
+
+// Nazwa i faza zdarzenia w formacie Chrome trace event.
+static void describe(const TraceEntry *e, const char **name, char *phase) {
+    static const char *names[] = {
+            [TRACE_READ_WAIT] = "readlock wait",
+            [TRACE_READ_GRANT] = "readlock wait",
+            [TRACE_WRITE_WAIT] = "writelock wait",
+            [TRACE_WRITE_GRANT] = "writelock wait",
+            [TRACE_READ_ACQUIRE] = "readlock",
+            [TRACE_WRITE_ACQUIRE] = "writelock",
+            [TRACE_READ_HANDOFF] = "handoff to readers",
+            [TRACE_WRITE_HANDOFF] = "handoff to writer",
+    };
+    switch (e->type) {
+        case TRACE_OP_BEGIN:
+        case TRACE_READ_WAIT:
+        case TRACE_WRITE_WAIT:
+            *phase = 'B';
+            break;
+        case TRACE_OP_END:
+        case TRACE_READ_GRANT:
+        case TRACE_WRITE_GRANT:
+            *phase = 'E';
+            break;
+        default:
+            *phase = 'i';
+    }
+    if (e->type == TRACE_OP_BEGIN || e->type == TRACE_OP_END)
+        *name = e->name;
+    else
+        *name = names[e->type];
+}
+
+static int dump_buffer(int fd, TraceBuffer *buffer, bool *first) {
+    uint64_t head = __atomic_load_n(&buffer->head, __ATOMIC_ACQUIRE);
+    uint64_t start = head > TRACE_BUFFER_SIZE ? head - TRACE_BUFFER_SIZE : 0;
+    for (uint64_t i = start; i < head; i++) {
+        TraceEntry *src = &buffer->entries[i % TRACE_BUFFER_SIZE], e;
+        e.seq = __atomic_load_n(&src->seq, __ATOMIC_ACQUIRE);
+        e.time = __atomic_load_n(&src->time, __ATOMIC_RELAXED);
+        e.object = __atomic_load_n(&src->object, __ATOMIC_RELAXED);
+        e.name = __atomic_load_n(&src->name, __ATOMIC_RELAXED);
+        e.tid = __atomic_load_n(&src->tid, __ATOMIC_RELAXED);
+        e.type = __atomic_load_n(&src->type, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        // Zdarzenie nadpisane przez właściciela w trakcie czytania pomijamy.
+        if (e.seq != i + 1 || __atomic_load_n(&src->seq, __ATOMIC_RELAXED) != e.seq)
+            continue;
+        const char *name;
+        char phase;
+        describe(&e, &name, &phase);
+        if (dprintf(fd, "%s{\"name\":\"%s\",\"ph\":\"%c\",%s\"ts\":%llu.%03llu,"
+                        "\"pid\":%d,\"tid\":%d,\"args\":{\"object\":\"%p\"}}",
+                    *first ? "" : ",\n", name, phase,
+                    phase == 'i' ? "\"s\":\"t\"," : "",
+                    (unsigned long long) (e.time / 1000),
+                    (unsigned long long) (e.time % 1000),
+                    (int) getpid(), e.tid, e.object) < 0)
+            return -1;
+        *first = false;
+    }
+    return 0;
+}
+
+int tree_trace_dump(int fd) {
+    int result = 0;
+    bool first = true;
+    if (dprintf(fd, "[\n") < 0)
+        return -1;
+    ptry(pthread_mutex_lock(&registry.mutex));
+    for (TraceBuffer *buffer = registry.buffers; buffer && result == 0;
+         buffer = buffer->next)
+        result = dump_buffer(fd, buffer, &first);
+    ptry(pthread_mutex_unlock(&registry.mutex));
+    if (result != 0 || dprintf(fd, "\n]\n") < 0)
+        return -1;
+    return 0;
+}
+
+#else
+
+int tree_trace_dump(int fd) {
+    if (dprintf(fd, "[]\n") < 0)
+        return -1;
+    return 0;
+}
+
+#endif
@@ -0,0 +1,40 @@
+#pragma once
+
+// Śledzenie przebiegu operacji i zdobywania locków. Każdy wątek zapisuje
+// zdarzenia do własnego bufora cyklicznego bez żadnej synchronizacji
+// z innymi wątkami, a tree_trace_dump zrzuca je w formacie Chrome trace
+// event (do obejrzenia w chrome://tracing lub Perfetto). Śledzenie jest
+// wkompilowywane tylko z flagą TREE_TRACE; bez niej TRACE nic nie robi.
+
+typedef enum TraceEvent {
+    // Początek i koniec operacji na drzewie (name to nazwa operacji)
+    TRACE_OP_BEGIN,
+    TRACE_OP_END,
+    // Początek czekania na lock i jego zdobycie po czekaniu
+    TRACE_READ_WAIT,
+    TRACE_READ_GRANT,
+    TRACE_WRITE_WAIT,
+    TRACE_WRITE_GRANT,
+    // Zdobycie locka bez czekania
+    TRACE_READ_ACQUIRE,
+    TRACE_WRITE_ACQUIRE,
+    // Przekazanie czytelni czekającym czytelnikom (przez rstate)
+    // lub pisarzowi (przez wstate)
+    TRACE_READ_HANDOFF,
+    TRACE_WRITE_HANDOFF
+} TraceEvent;
+
+#ifdef TREE_TRACE
+// Zapisuje zdarzenie dotyczące obiektu `object` (wierzchołka lub drzewa).
+// `name` musi być napisem stałym przez cały czas działania programu.
+void trace_record(TraceEvent type, const void *object, const char *name);
+
+#define TRACE(type, object, name) trace_record(type, object, name)
+#else
+#define TRACE(type, object, name) ((void) 0)
+#endif
+
+// Zapisuje do deskryptora `fd` zdarzenia ze wszystkich buforów jako tablicę
+// JSON w formacie Chrome trace event. Bez TREE_TRACE zapisuje pustą
+// tablicę. Zwraca 0 albo -1 z ustawionym errno, jeśli zapis się nie udał.
+int tree_trace_dump(int fd);
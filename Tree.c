@@ -1,9 +1,11 @@
 #include <errno.h>
 #include <malloc.h>
-#include "HashMap.h"
 #include <string.h>
 #include "path_utils.h"
 #include "Node.h"
+#include "Trace.h"
+#include "Walk.h"
+#include "Watch.h"
 
 #include "Tree.h"
 
@@ -11,6 +13,8 @@
 // tworzymy osobny struct na drzewo
 typedef struct Tree {
     Node *root;
+    Versions *versions;
+    Watches *watches;
 } Tree;
 
 Tree *tree_new() {
@@ -18,15 +22,19 @@ Tree *tree_new() {
     if (t == NULL)
         fatal("Memory allocation failed");
     t->root = node_new(NULL);
+    t->versions = versions_new();
+    t->watches = watches_new();
     return t;
 }
 
 void tree_free(Tree *t) {
     node_free(t->root);
+    versions_free(t->versions);
+    watches_free(t->watches);
     free(t);
 }
 
-char *tree_list(Tree *tree, const char *path) {
+static char *list_op(Tree *tree, const char *path) {
     if (!is_path_valid(path))
         return NULL;
     // Protokół wstępny, jeśli nie znajdziemy wierzchołka, zwracamy NULL
@@ -34,13 +42,94 @@ char *tree_list(Tree *tree, const char *path) {
         return NULL;
     Node *current = get_node(tree->root, path);
     // Sekcja krytyczna
-    char *result = make_map_contents_string(get_children(current));
+    char *result = make_children_string(get_children(current));
     // Protokół końcowy
     release_held_readlocks(current, current);
     return result;
 }
 
-int tree_move(Tree *tree, const char *source, const char *target) {
+char *tree_list(Tree *tree, const char *path) {
+    TRACE(TRACE_OP_BEGIN, tree, "tree_list");
+    char *result = list_op(tree, path);
+    TRACE(TRACE_OP_END, tree, "tree_list");
+    return result;
+}
+
+// Sekcja krytyczna tree_move, wymaga writelocków na source_node
+// i target_node (rodzicach przenoszonego i docelowego wierzchołka).
+static int move_in(Tree *tree, const char *source, const char *target,
+                   Node *source_node, const char *source_name,
+                   Node *target_node, const char *dest_name) {
+    Node *to_move = children_get(get_children(source_node), source_name);
+    // Jeśli nie istnieje wierzchołek, który chcemy przenieść
+    if (to_move == NULL)
+        return ENOENT;
+    // Jeśli przeniesienie by nic nie zrobiło
+    if (strcmp(source, target) == 0)
+        return 0;
+    // Jeśli chcemy przenieść folder do swojego własnego podfolderu
+    if (strncmp(source, target, strlen(source)) == 0)
+        return -1;
+    // Jeśli istnieje już docelowy wierzchołek
+    if (get_node(tree->root, target) != NULL)
+        return EEXIST;
+    set_father(to_move, target_node);
+    node_remove_child(tree->versions, source_node, source_name);
+    node_insert_child(tree->versions, target_node, dest_name, to_move);
+    return 0;
+}
+
+// Zgłasza obserwacjom przeniesienie folderu (jeśli faktycznie go przeniosło).
+static void post_move(Tree *tree, const char *source, const char *target) {
+    if (strcmp(source, target) == 0 ||
+        (!watches_covered(tree->watches, source) &&
+         !watches_covered(tree->watches, target)))
+        return;
+    uint64_t cookie = watches_cookie(tree->watches);
+    watches_post(tree->watches, TREE_EVENT_MOVED_FROM, source, cookie);
+    watches_post(tree->watches, TREE_EVENT_MOVED_TO, target, cookie);
+}
+
+// Sekcja krytyczna tree_move w obrębie jednego folderu, wymaga writelocka
+// na node. Przeniesiony wierzchołek i jego poddrzewo zostają na miejscu,
+// zmienia się tylko klucz w zbiorze dzieci.
+static int rename_in(Tree *tree, Node *node, const char *source_name,
+                     const char *dest_name) {
+    // Sprawdzamy przed zmianą, bo node_rename_child stempluje wierzchołek
+    // i zamraża kopię dzieci, nawet gdy nic nie zmieni.
+    Children *children = get_children(node);
+    if (children_get(children, source_name) == NULL)
+        return ENOENT;
+    // Przeniesienie folderu na niego samego nic nie robi.
+    if (strcmp(source_name, dest_name) == 0)
+        return 0;
+    if (children_get(children, dest_name) != NULL)
+        return EEXIST;
+    node_rename_child(tree->versions, node, source_name, dest_name);
+    return 0;
+}
+
+// Przeniesienie w obrębie jednego folderu: zamiast start_write na dwóch
+// ścieżkach wystarczy writelock na wspólnym rodzicu.
+static int rename_op(Tree *tree, const char *source, const char *target,
+                     const char *parent, const char *source_name,
+                     const char *dest_name) {
+    // Protokół wstępny
+    if (!start_write(tree->root, parent, parent))
+        return ENOENT;
+    Node *node = get_node(tree->root, parent);
+    // Sekcja krytyczna
+    versions_write_begin(tree->versions);
+    int result = rename_in(tree, node, source_name, dest_name);
+    versions_write_end(tree->versions);
+    // Protokół końcowy
+    if (result == 0)
+        post_move(tree, source, target);
+    end_write(node, node);
+    return result;
+}
+
+static int move_op(Tree *tree, const char *source, const char *target) {
     if (strcmp(source, "/") == 0)
         return EBUSY;
     // Rozważamy ten przypadek na początku, żeby nie zajmować się potem tym,
@@ -53,6 +142,13 @@ int tree_move(Tree *tree, const char *source, const char *target) {
     char source_name[MAX_FOLDER_NAME_LENGTH + 1];
     char *target_parent = make_path_to_parent(target, dest_name);
     char *source_parent = make_path_to_parent(source, source_name);
+    if (strcmp(source_parent, target_parent) == 0) {
+        int result = rename_op(tree, source, target, source_parent,
+                               source_name, dest_name);
+        free(target_parent);
+        free(source_parent);
+        return result;
+    }
     // Protokół wstępny
     if (!start_write(tree->root, source_parent, target_parent)) {
         free(target_parent);
@@ -61,47 +157,113 @@ int tree_move(Tree *tree, const char *source, const char *target) {
     }
     Node *source_node = get_node(tree->root, source_parent),
             *target_node = get_node(tree->root, target_parent);
-    Node *to_move = hmap_get(get_children(source_node), source_name);
-    // Jeśli nie istnieje wierzchołek, który chcemy przenieść
-    if (to_move == NULL) {
-        end_write(source_node, target_node);
-        free(target_parent);
-        free(source_parent);
-        return ENOENT;
-    }
-    // Jeśli przeniesienie by nic nie zrobiło
-    if (strcmp(source, target) == 0) {
-        end_write(source_node, target_node);
-        free(target_parent);
-        free(source_parent);
-        return 0;
-    }
-    // Jeśli chcemy przenieść folder do swojego własnego podfolderu
-    if (strncmp(source, target, strlen(source)) == 0) {
-        end_write(source_node, target_node);
-        free(target_parent);
-        free(source_parent);
-        return -1;
-    }
-    // Jeśli istnieje już docelowy wierzchołek
-    if (get_node(tree->root, target) != NULL) {
-        end_write(source_node, target_node);
-        free(target_parent);
-        free(source_parent);
-        return EEXIST;
-    }
     // Sekcja krytyczna
-    set_father(to_move, target_node);
-    hmap_remove(get_children(source_node), source_name);
-    hmap_insert(get_children(target_node), dest_name, to_move);
+    versions_write_begin(tree->versions);
+    int result = move_in(tree, source, target, source_node, source_name,
+                         target_node, dest_name);
+    versions_write_end(tree->versions);
     // Protokół końcowy
+    if (result == 0)
+        post_move(tree, source, target);
     end_write(source_node, target_node);
     free(target_parent);
     free(source_parent);
+    return result;
+}
+
+int tree_move(Tree *tree, const char *source, const char *target) {
+    TRACE(TRACE_OP_BEGIN, tree, "tree_move");
+    int result = move_op(tree, source, target);
+    TRACE(TRACE_OP_END, tree, "tree_move");
+    return result;
+}
+
+static int copy_op(Tree *tree, const char *source, const char *target) {
+    if (!is_path_valid(source) || !is_path_valid(target))
+        return EINVAL;
+    if (strcmp(target, "/") == 0)
+        return EEXIST;
+    char name[MAX_FOLDER_NAME_LENGTH + 1];
+    char *parent = make_path_to_parent(target, name);
+    // Protokół wstępny
+    if (!start_write(tree->root, parent, parent)) {
+        free(parent);
+        return ENOENT;
+    }
+    Node *node = get_node(tree->root, parent);
+    // Źródło czytamy ze snapshotu, więc nie potrzebujemy na nim locków.
+    // Zaczynamy go pod writelockiem na rodzicu celu, żeby między snapshotem
+    // a wstawieniem kopii nic się w rodzicu nie zmieniło.
+    uint64_t version = versions_snapshot_begin(tree->versions);
+    Node *source_node = get_node_at(tree->root, source, version);
+    int result = 0;
+    // Sekcja krytyczna
+    if (source_node == NULL) {
+        result = ENOENT;
+    } else if (children_get(get_children(node), name) != NULL) {
+        result = EEXIST;
+    } else {
+        versions_write_begin(tree->versions);
+        node_insert_child(tree->versions, node, name,
+                          node_copy_at(tree->versions, source_node, version,
+                                       node));
+        versions_write_end(tree->versions);
+    }
+    if (result != 0)
+        versions_snapshot_end(tree->versions, version);
+    // Protokół końcowy
+    if (result == 0)
+        watches_post(tree->watches, TREE_EVENT_CREATED, target, 0);
+    end_write(node, node);
+    free(parent);
+    return result;
+}
+
+int tree_copy(Tree *tree, const char *source, const char *target) {
+    TRACE(TRACE_OP_BEGIN, tree, "tree_copy");
+    int result = copy_op(tree, source, target);
+    TRACE(TRACE_OP_END, tree, "tree_copy");
+    return result;
+}
+
+// Sekcja krytyczna tree_create, wymaga writelocka na node.
+static int create_in(Tree *tree, Node *node, const char *name) {
+    // Jeśli istnieje już wierzchołek, który chcemy stworzyć
+    if (children_get(get_children(node), name) != NULL)
+        return EEXIST;
+    Node *new = node_create(tree->versions, node);
+    node_insert_child(tree->versions, node, name, new);
     return 0;
 }
 
-int tree_create(Tree *tree, const char *path) {
+// Odczepia od node puste dziecko o podanej nazwie, nie zwalniając go,
+// i zapisuje je w `*detached`. Wymaga writelocka na node.
+static int detach_in(Tree *tree, Node *node, const char *name,
+                     Node **detached) {
+    Node *old = children_get(get_children(node), name);
+    // Jeśli nie istnieje wierzchołek, który chcemy usunąć
+    if (old == NULL)
+        return ENOENT;
+    // Jeśli wierzchołek ma dzieci
+    if (children_size(get_children(old)) != 0)
+        return ENOTEMPTY;
+    node_remove_child(tree->versions, node, name);
+    *detached = old;
+    return 0;
+}
+
+// Sekcja krytyczna tree_remove, wymaga writelocka na node.
+static int remove_in(Tree *tree, Node *node, const char *name) {
+    Node *old;
+    int result = detach_in(tree, node, name, &old);
+    // Tutaj mamy writelock na node, więc tym bardziej mamy wyłączny dostęp
+    // do old (ale mogą go jeszcze widzieć snapshoty)
+    if (result == 0)
+        node_retire(tree->versions, old);
+    return result;
+}
+
+static int create_op(Tree *tree, const char *path) {
     if (!is_path_valid(path))
         return EINVAL;
     Node *node;
@@ -116,22 +278,26 @@ int tree_create(Tree *tree, const char *path) {
         return ENOENT;
     }
     node = get_node(tree->root, parent);
-    // Jeśli istnieje już wierzchołek, który chcemy stworzyć
-    if (hmap_get(get_children(node), name) != NULL) {
-        end_write(node, node);
-        free(parent);
-        return EEXIST;
-    }
-    Node *new = node_new(node);
     // Sekcja krytyczna
-    hmap_insert(get_children(node), name, new);
+    versions_write_begin(tree->versions);
+    int result = create_in(tree, node, name);
+    versions_write_end(tree->versions);
     // Protokół końcowy
+    if (result == 0)
+        watches_post(tree->watches, TREE_EVENT_CREATED, path, 0);
     end_write(node, node);
     free(parent);
-    return 0;
+    return result;
 }
 
-int tree_remove(Tree *tree, const char *path) {
+int tree_create(Tree *tree, const char *path) {
+    TRACE(TRACE_OP_BEGIN, tree, "tree_create");
+    int result = create_op(tree, path);
+    TRACE(TRACE_OP_END, tree, "tree_create");
+    return result;
+}
+
+static int remove_op(Tree *tree, const char *path) {
     if (!is_path_valid(path))
         return EINVAL;
     if (strcmp(path, "/") == 0)
@@ -145,24 +311,401 @@ int tree_remove(Tree *tree, const char *path) {
         return ENOENT;
     }
     node = get_node(tree->root, parent);
-    Node *old = hmap_get(get_children(node), name);
-    // Jeśli nie istnieje wierzchołek, który chcemy usunąć
-    if (old == NULL) {
-        end_write(node, node);
-        free(parent);
-        return ENOENT;
+    // Sekcja krytyczna
+    versions_write_begin(tree->versions);
+    int result = remove_in(tree, node, name);
+    versions_write_end(tree->versions);
+    // Protokół końcowy
+    if (result == 0)
+        watches_post(tree->watches, TREE_EVENT_REMOVED, path, 0);
+    end_write(node, node);
+    free(parent);
+    return result;
+}
+
+int tree_remove(Tree *tree, const char *path) {
+    TRACE(TRACE_OP_BEGIN, tree, "tree_remove");
+    int result = remove_op(tree, path);
+    TRACE(TRACE_OP_END, tree, "tree_remove");
+    return result;
+}
+
+// Zapisuje do `path` ścieżkę dziecka o nazwie `name` folderu `parent`.
+// Zwraca fałsz, jeśli name nie jest poprawną nazwą folderu albo ścieżka
+// byłaby dłuższa niż MAX_PATH_LENGTH.
+static bool child_path(const char *parent, const char *name, char *path) {
+    size_t parent_length = strlen(parent), name_length = strlen(name);
+    if (strchr(name, '/') != NULL ||
+        parent_length + name_length + 1 > MAX_PATH_LENGTH)
+        return false;
+    memcpy(path, parent, parent_length);
+    memcpy(path + parent_length, name, name_length);
+    strcpy(path + parent_length + name_length, "/");
+    return is_path_valid(path);
+}
+
+void tree_batch(Tree *tree, const char *parent, const TreeOpType *types,
+                const char *const *names, size_t n, int *results) {
+    TRACE(TRACE_OP_BEGIN, tree, "tree_batch");
+    char path[MAX_PATH_LENGTH + 1];
+    int failure = is_path_valid(parent) ? ENOENT : EINVAL;
+    // Protokół wstępny — jeden dla wszystkich operacji
+    if (failure == EINVAL || !start_write(tree->root, parent, parent)) {
+        for (size_t i = 0; i < n; i++)
+            results[i] = failure;
+        TRACE(TRACE_OP_END, tree, "tree_batch");
+        return;
     }
-    // Jeśli wierzchołek ma dzieci
-    if (hmap_size(get_children(old)) != 0) {
-        end_write(node, node);
-        free(parent);
-        return ENOTEMPTY;
+    Node *node = get_node(tree->root, parent);
+    // Sekcja krytyczna
+    versions_write_begin(tree->versions);
+    for (size_t i = 0; i < n; i++) {
+        if (!child_path(parent, names[i], path))
+            results[i] = EINVAL;
+        else if (types[i] == TREE_CREATE)
+            results[i] = create_in(tree, node, names[i]);
+        else if (types[i] == TREE_REMOVE)
+            results[i] = remove_in(tree, node, names[i]);
+        else
+            results[i] = EINVAL;
+    }
+    versions_write_end(tree->versions);
+    // Protokół końcowy
+    if (watches_active(tree->watches)) {
+        for (size_t i = 0; i < n; i++) {
+            if (results[i] != 0)
+                continue;
+            child_path(parent, names[i], path);
+            watches_post(tree->watches, types[i] == TREE_CREATE ?
+                         TREE_EVENT_CREATED : TREE_EVENT_REMOVED, path, 0);
+        }
     }
-    // Sekcja krytyczna — tutaj mamy writelock na node, więc tym bardziej
-    // mamy wyłączny dostęp do old
-    node_free(old);
-    hmap_remove(get_children(node), name);
     end_write(node, node);
-    free(parent);
+    TRACE(TRACE_OP_END, tree, "tree_batch");
+}
+
+// Operacja zapisana w transakcji.
+typedef struct TxnOp {
+    TreeOpType type;
+    char *path, *target;
+} TxnOp;
+
+// Informacje potrzebne do wycofania wykonanej operacji.
+typedef struct TxnUndo {
+    bool done;
+    // Wierzchołek odczepiony przez TREE_REMOVE, zwalniany dopiero, gdy cała
+    // transakcja się powiedzie
+    Node *detached;
+} TxnUndo;
+
+struct TreeTxn {
+    Tree *tree;
+    TxnOp *ops;
+    size_t n_ops, capacity;
+};
+
+TreeTxn *tree_txn_begin(Tree *tree) {
+    TreeTxn *txn = malloc(sizeof(TreeTxn));
+    if (txn == NULL)
+        fatal("Memory allocation failed");
+    txn->tree = tree;
+    txn->ops = NULL;
+    txn->n_ops = txn->capacity = 0;
+    return txn;
+}
+
+int tree_txn_add(TreeTxn *txn, TreeOpType type, const char *path,
+                 const char *target) {
+    if (type != TREE_CREATE && type != TREE_REMOVE && type != TREE_MOVE)
+        return EINVAL;
+    if (!is_path_valid(path) || (type == TREE_MOVE && !is_path_valid(target)))
+        return EINVAL;
+    if (txn->n_ops == txn->capacity) {
+        txn->capacity = txn->capacity ? 2 * txn->capacity : 4;
+        txn->ops = realloc(txn->ops, txn->capacity * sizeof(TxnOp));
+        if (txn->ops == NULL)
+            fatal("Memory allocation failed");
+    }
+    TxnOp *op = &txn->ops[txn->n_ops++];
+    op->type = type;
+    op->path = strdup(path);
+    op->target = type == TREE_MOVE ? strdup(target) : NULL;
     return 0;
-}
\ No newline at end of file
+}
+
+void tree_txn_abort(TreeTxn *txn) {
+    for (size_t i = 0; i < txn->n_ops; i++) {
+        free(txn->ops[i].path);
+        free(txn->ops[i].target);
+    }
+    free(txn->ops);
+    free(txn);
+}
+
+// Wykonuje operację transakcji. Wymaga writelocków zdobytych przez
+// start_write_many na rodzicach wszystkich ścieżek transakcji.
+static int txn_apply(Tree *tree, TxnOp *op, TxnUndo *undo) {
+    char name[MAX_FOLDER_NAME_LENGTH + 1], dest_name[MAX_FOLDER_NAME_LENGTH + 1];
+    char *parent = NULL, *target_parent = NULL;
+    Node *node, *target_node;
+    int result;
+    undo->done = false;
+    undo->detached = NULL;
+    switch (op->type) {
+        case TREE_CREATE:
+            if ((parent = make_path_to_parent(op->path, name)) == NULL)
+                return EEXIST;
+            if ((node = get_node(tree->root, parent)) == NULL)
+                result = ENOENT;
+            else
+                result = create_in(tree, node, name);
+            break;
+        case TREE_REMOVE:
+            if ((parent = make_path_to_parent(op->path, name)) == NULL)
+                return EBUSY;
+            if ((node = get_node(tree->root, parent)) == NULL)
+                result = ENOENT;
+            else
+                result = detach_in(tree, node, name, &undo->detached);
+            break;
+        default:
+            if ((parent = make_path_to_parent(op->path, name)) == NULL)
+                return EBUSY;
+            if ((target_parent = make_path_to_parent(op->target,
+                                                     dest_name)) == NULL) {
+                free(parent);
+                return EEXIST;
+            }
+            node = get_node(tree->root, parent);
+            target_node = get_node(tree->root, target_parent);
+            if (node == NULL || target_node == NULL)
+                result = ENOENT;
+            else
+                result = move_in(tree, op->path, op->target, node, name,
+                                 target_node, dest_name);
+    }
+    free(parent);
+    free(target_parent);
+    undo->done = result == 0;
+    return result;
+}
+
+// Wycofuje wykonaną operację. Wymaga, żeby wszystkie późniejsze operacje
+// transakcji były już wycofane.
+static void txn_undo(Tree *tree, TxnOp *op, TxnUndo *undo) {
+    char name[MAX_FOLDER_NAME_LENGTH + 1], dest_name[MAX_FOLDER_NAME_LENGTH + 1];
+    if (!undo->done)
+        return;
+    char *parent = make_path_to_parent(op->path, name);
+    Node *node = get_node(tree->root, parent);
+    if (op->type == TREE_CREATE) {
+        remove_in(tree, node, name);
+    } else if (op->type == TREE_REMOVE) {
+        node_insert_child(tree->versions, node, name, undo->detached);
+    } else {
+        char *target_parent = make_path_to_parent(op->target, dest_name);
+        Node *target_node = get_node(tree->root, target_parent);
+        move_in(tree, op->target, op->path, target_node, dest_name,
+                node, name);
+        free(target_parent);
+    }
+    free(parent);
+}
+
+int tree_txn_commit(TreeTxn *txn, size_t *failed) {
+    Tree *tree = txn->tree;
+    TRACE(TRACE_OP_BEGIN, tree, "tree_txn_commit");
+    size_t n = txn->n_ops, n_paths = 0, failed_at = 0;
+    // Zbieramy ścieżki do rodziców wszystkich modyfikowanych wierzchołków
+    char **paths = malloc((2 * n + 1) * sizeof(char *));
+    if (paths == NULL)
+        fatal("Memory allocation failed");
+    for (size_t i = 0; i < n; i++) {
+        if ((paths[n_paths] = make_path_to_parent(txn->ops[i].path, NULL)))
+            n_paths++;
+        if (txn->ops[i].target &&
+            (paths[n_paths] = make_path_to_parent(txn->ops[i].target, NULL)))
+            n_paths++;
+    }
+    int result = 0;
+    LockSet locks;
+    // Protokół wstępny. Jeśli któryś z rodziców nie istnieje, to nie mogła
+    // go stworzyć żadna operacja transakcji (bo wtedy mielibyśmy writelocka
+    // na jego przodku), ale o tym, która operacja nie powiedzie się pierwsza,
+    // decyduje kolejność operacji, a nie ścieżek. Dlatego zamiast zgadywać,
+    // cofamy wszystkie ścieżki z brakującym prefiksem do jego ojca i
+    // próbujemy jeszcze raz, aż locki się uda zdobyć (korzeń zawsze
+    // istnieje), a potem wykonujemy operacje po kolei jak zwykle.
+    while (!start_write_many(tree->root, (const char **) paths, n_paths,
+                             &locks)) {
+        size_t len = strlen(locks.failed), parent_len = len - 1;
+        while (locks.failed[parent_len - 1] != '/')
+            parent_len--;
+        char missing[MAX_PATH_LENGTH + 1];
+        strcpy(missing, locks.failed);
+        for (size_t i = 0; i < n_paths; i++) {
+            if (strncmp(paths[i], missing, len) == 0)
+                paths[i][parent_len] = '\0';
+        }
+    }
+    // Sekcja krytyczna — wykonujemy operacje po kolei, a jeśli któraś
+    // się nie powiedzie, wycofujemy wcześniejsze w odwrotnej kolejności.
+    TxnUndo *undo = malloc((n + 1) * sizeof(TxnUndo));
+    if (undo == NULL)
+        fatal("Memory allocation failed");
+    versions_write_begin(tree->versions);
+    size_t done = 0;
+    while (done < n && (result = txn_apply(tree, &txn->ops[done],
+                                           &undo[done])) == 0)
+        done++;
+    if (result != 0) {
+        failed_at = done;
+        while (done-- > 0)
+            txn_undo(tree, &txn->ops[done], &undo[done]);
+    }
+    for (size_t i = 0; result == 0 && i < n; i++) {
+        if (undo[i].detached)
+            node_retire(tree->versions, undo[i].detached);
+    }
+    versions_write_end(tree->versions);
+    // Protokół końcowy
+    for (size_t i = 0; result == 0 && i < n; i++) {
+        TxnOp *op = &txn->ops[i];
+        if (op->type == TREE_CREATE)
+            watches_post(tree->watches, TREE_EVENT_CREATED, op->path, 0);
+        else if (op->type == TREE_REMOVE)
+            watches_post(tree->watches, TREE_EVENT_REMOVED, op->path, 0);
+        else
+            post_move(tree, op->path, op->target);
+    }
+    end_write_many(&locks);
+    free(undo);
+    if (failed && result != 0)
+        *failed = failed_at;
+    for (size_t i = 0; i < n_paths; i++)
+        free(paths[i]);
+    free(paths);
+    tree_txn_abort(txn);
+    TRACE(TRACE_OP_END, tree, "tree_txn_commit");
+    return result;
+}
+
+struct TreeSnapshot {
+    Tree *tree;
+    uint64_t version;
+};
+
+TreeSnapshot *tree_snapshot_begin(Tree *tree) {
+    TreeSnapshot *snapshot = malloc(sizeof(TreeSnapshot));
+    if (snapshot == NULL)
+        fatal("Memory allocation failed");
+    snapshot->tree = tree;
+    snapshot->version = versions_snapshot_begin(tree->versions);
+    return snapshot;
+}
+
+void tree_snapshot_end(TreeSnapshot *snapshot) {
+    versions_snapshot_end(snapshot->tree->versions, snapshot->version);
+    free(snapshot);
+}
+
+char *tree_snapshot_list(TreeSnapshot *snapshot, const char *path) {
+    if (!is_path_valid(path))
+        return NULL;
+    // Nie bierzemy żadnych locków, więc nie blokujemy pisarzy.
+    Node *node = get_node_at(snapshot->tree->root, path, snapshot->version);
+    if (node == NULL)
+        return NULL;
+    return node_list_at(node, snapshot->version);
+}
+
+int tree_walk(Tree *tree, const char *path, TreeVisitor visitor, void *arg,
+              const TreeWalkOptions *opts) {
+    if (!is_path_valid(path))
+        return EINVAL;
+    return walk_subtree(tree->root, path, NULL, true, visitor, arg, opts);
+}
+
+int tree_find(Tree *tree, const char *path, const char *pattern,
+              TreeVisitor visitor, void *arg, const TreeWalkOptions *opts) {
+    if (!is_path_valid(path) || pattern == NULL)
+        return EINVAL;
+    return walk_subtree(tree->root, path, pattern, false, visitor, arg, opts);
+}
+
+void tree_memory_usage(Tree *tree, TreeMemoryUsage *usage) {
+    memset(usage, 0, sizeof(TreeMemoryUsage));
+    start_read(tree->root, "/");
+    node_memory_usage(tree->root, usage);
+    release_held_readlocks(tree->root, tree->root);
+    usage->name_bytes = name_pool_memory();
+    usage->total_bytes = usage->node_bytes + usage->sync_bytes +
+                         usage->children_bytes + usage->history_bytes +
+                         usage->name_bytes;
+}
+
+// Kompaktuje folder o podanej ścieżce i wkłada na stos ścieżki jego dzieci.
+static void compact_in(Tree *tree, const char *path, char ***stack,
+                       size_t *size, size_t *capacity) {
+    // Protokół wstępny (folder mógł zostać w międzyczasie usunięty)
+    if (!start_write(tree->root, path, path))
+        return;
+    Node *node = get_node(tree->root, path);
+    // Sekcja krytyczna
+    versions_write_begin(tree->versions);
+    if (node_compact(tree->versions, node)) {
+        Children *children = get_children(node);
+        size_t length = strlen(path);
+        Name key;
+        void *value;
+        for (ChildrenIterator it = children_iterator(children);
+             children_next(children, &it, &key, &value);) {
+            if (*size == *capacity) {
+                *capacity = *capacity ? 2 * *capacity : 16;
+                *stack = realloc(*stack, *capacity * sizeof(char *));
+                if (*stack == NULL)
+                    fatal("Memory allocation failed");
+            }
+            char *child = malloc(length + MAX_FOLDER_NAME_LENGTH + 2);
+            if (child == NULL)
+                fatal("Memory allocation failed");
+            memcpy(child, path, length);
+            size_t name_length = name_to_string(key, child + length);
+            strcpy(child + length + name_length, "/");
+            (*stack)[(*size)++] = child;
+        }
+    }
+    versions_write_end(tree->versions);
+    // Protokół końcowy
+    end_write(node, node);
+}
+
+static void compact_op(Tree *tree) {
+    // Ścieżki folderów do skompaktowania. Każdy folder kompaktujemy osobno,
+    // więc między nimi drzewo może się zmieniać — folderów stworzonych
+    // w międzyczasie możemy nie odwiedzić, a usunięte pomijamy.
+    char **stack = NULL;
+    size_t size = 0, capacity = 0;
+    compact_in(tree, "/", &stack, &size, &capacity);
+    while (size > 0) {
+        char *path = stack[--size];
+        compact_in(tree, path, &stack, &size, &capacity);
+        free(path);
+    }
+    free(stack);
+    // Oddajemy systemowi to, co się da — tylko wolne strony i koniec sterty,
+    // więc zysk zależy od tego, gdzie malloc umieścił nowe alokacje.
+    malloc_trim(0);
+}
+
+void tree_compact(Tree *tree) {
+    TRACE(TRACE_OP_BEGIN, tree, "tree_compact");
+    compact_op(tree);
+    TRACE(TRACE_OP_END, tree, "tree_compact");
+}
+
+TreeWatch *tree_watch(Tree *tree, const char *path, bool recursive) {
+    if (!is_path_valid(path))
+        return NULL;
+    return watch_new(tree->watches, path, recursive);
+}
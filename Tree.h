@@ -1,5 +1,9 @@
 #pragma once
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
 typedef struct Tree Tree; // Let "Tree" mean the same as "struct Tree".
 
 Tree* tree_new();
@@ -13,3 +17,211 @@ int tree_create(Tree* tree, const char* path);
 int tree_remove(Tree* tree, const char* path);
 
 int tree_move(Tree* tree, const char* source, const char* target);
+
+// Tworzy folder `target` jako kopię folderu `source` razem z całym jego
+// poddrzewem, w postaci z jednej chwili. Poddrzewa do kilkuset folderów są
+// kopiowane od razu. Większe są kopiowane leniwie: kopia współdzieli
+// strukturę ze źródłem, a foldery są kopiowane poziomami przy pierwszym
+// użyciu (puste od razu). Do skopiowania ostatniego folderu, który ma
+// dzieci, kopia trzyma snapshot całego drzewa, więc pierwsza zmiana
+// każdego folderu, który istniał w chwili kopiowania, zamraża kopię jego
+// dzieci, a usunięte wtedy foldery są zwalniane dopiero z tym snapshotem.
+// Foldery stworzone po kopiowaniu nie kosztują nic dodatkowo, więc narzut
+// jest ograniczony rozmiarem drzewa w chwili kopiowania. Zwraca 0,
+// EINVAL dla niepoprawnych ścieżek, ENOENT, jeśli nie istnieje `source`
+// albo rodzic `target`, i EEXIST, jeśli `target` już istnieje. Kopia może
+// leżeć wewnątrz źródła (nie obejmuje wtedy samej siebie).
+int tree_copy(Tree* tree, const char* source, const char* target);
+
+// Rodzaje operacji na drzewie, używane przez interfejsy wykonujące wiele
+// operacji naraz.
+typedef enum TreeOpType {
+    TREE_CREATE,
+    TREE_REMOVE,
+    TREE_MOVE,
+    TREE_LIST
+} TreeOpType;
+
+// Wykonuje n operacji TREE_CREATE i TREE_REMOVE na dzieciach folderu `parent`
+// o nazwach names[i] pod jednym writelockiem na tym folderze, po kolei.
+// Do results[i] trafia to, co zwróciłoby odpowiednie tree_create lub
+// tree_remove (dla innych rodzajów operacji EINVAL). Jeśli `parent` nie jest
+// poprawną ścieżką, wszystkie wyniki to EINVAL, a jeśli names[i] nie jest
+// poprawną nazwą folderu albo ścieżka dziecka byłaby za długa — results[i].
+void tree_batch(Tree *tree, const char *parent, const TreeOpType *types,
+                const char *const *names, size_t n, int *results);
+
+// Transakcja — ciąg operacji TREE_CREATE, TREE_REMOVE i TREE_MOVE
+// wykonywanych atomowo.
+typedef struct TreeTxn TreeTxn;
+
+// Zaczyna nową, pustą transakcję.
+TreeTxn *tree_txn_begin(Tree *tree);
+
+// Dodaje operację na koniec transakcji (`target` jest używane tylko dla
+// TREE_MOVE). Ścieżki są kopiowane. Zwraca EINVAL, jeśli rodzaj operacji
+// lub któraś ze ścieżek są niepoprawne, a 0 wpp.
+int tree_txn_add(TreeTxn *txn, TreeOpType type, const char *path,
+                 const char *target);
+
+// Wykonuje operacje transakcji po kolei w jednej sekcji krytycznej,
+// zdobywając writelocki tylko na minimalnym zbiorze wierzchołków, więc
+// transakcje na rozłącznych częściach drzewa wykonują się równolegle.
+// Jeśli wszystkie operacje się powiodą, zwraca 0 i nie zmienia `*failed`.
+// Wpp nie zmienia drzewa, zwraca to, co zwróciła pierwsza nieudana
+// operacja, i zapisuje jej indeks w `*failed` (jeśli failed nie jest NULL).
+// Zwalnia transakcję.
+int tree_txn_commit(TreeTxn *txn, size_t *failed);
+
+// Porzuca transakcję bez wykonywania jej operacji.
+void tree_txn_abort(TreeTxn *txn);
+
+// Snapshot — widok drzewa z chwili jego początku. Czytanie ze snapshotu nie
+// bierze readlocków, więc nie blokuje pisarzy, a wszystkie odczyty z jednego
+// snapshotu są ze sobą spójne.
+typedef struct TreeSnapshot TreeSnapshot;
+
+// Zaczyna snapshot. Czeka tylko na zakończenie trwających sekcji
+// krytycznych operacji modyfikujących drzewo.
+TreeSnapshot *tree_snapshot_begin(Tree *tree);
+
+// Kończy snapshot i zwalnia wersje drzewa, których nikt już nie potrzebuje.
+// Wszystkie snapshoty trzeba zakończyć przed tree_free.
+void tree_snapshot_end(TreeSnapshot *snapshot);
+
+// Odpowiednik tree_list dla drzewa w postaci ze snapshotu.
+char *tree_snapshot_list(TreeSnapshot *snapshot, const char *path);
+
+// Funkcja wołana przez tree_walk i tree_find dla znalezionych folderów.
+// Dostaje pełną ścieżkę folderu i argument podany przy wywołaniu. Zwraca 0,
+// żeby kontynuować przechodzenie, a cokolwiek innego, żeby je przerwać.
+// Jest wołana pod readlockami na folderze i jego przodkach, więc nie może
+// wołać żadnych funkcji tree_* dla tego drzewa, także czytających: tree_list
+// zdobywa readlocki od korzenia i czeka, jeśli na którymś folderze czeka
+// pisarz, a pisarz może czekać na folder trzymany przez przejście.
+typedef int (*TreeVisitor)(const char *path, void *arg);
+
+// Ustawienia przechodzenia poddrzewa.
+typedef struct TreeWalkOptions {
+    // Liczba wątków przechodzących poddrzewo, razem z wołającym (0 i 1
+    // oznaczają, że przechodzi tylko wołający). Pozostałe wątki są brane
+    // z puli wspólnej dla całego procesu, a nowe są tworzone tylko wtedy,
+    // gdy w puli brakuje wolnych; raz stworzone czekają na kolejne
+    // przejścia do końca procesu.
+    size_t threads;
+    // Czy wywołania visitora mają się nie nakładać w czasie (wpp przy
+    // więcej niż jednym wątku mogą być wołane równolegle)
+    bool serialize;
+} TreeWalkOptions;
+
+// Woła visitor dla folderu `path` i wszystkich jego potomków, w dowolnej
+// kolejności, ale zawsze dla folderu przed jego potomkami. Zdobywa readlocki
+// tylko raz, schodząc od `path` w dół, i trzyma je na folderze, dopóki
+// przechodzenie jego poddrzewa się nie skończy, więc odwiedzony folder nie
+// zmienia dzieci, dopóki nie odwiedzimy ich wszystkich. Locków nie bierze
+// w kolejności leksykograficznej, ale nie czeka na folder, dopóki ma inne
+// foldery do odwiedzenia. Niezależne poddrzewa są rozdzielane między wątki
+// (opts może być NULL — wtedy przechodzi tylko wołający). Zwraca 0,
+// EINVAL dla niepoprawnej ścieżki, ENOENT, jeśli folder nie istnieje,
+// albo niezerowy wynik visitora, który przerwał przechodzenie.
+int tree_walk(Tree *tree, const char *path, TreeVisitor visitor, void *arg,
+              const TreeWalkOptions *opts);
+
+// Tak jak tree_walk, ale woła visitor tylko dla potomków folderu `path`
+// (bez niego samego), których nazwa pasuje do wzorca `pattern` w sensie
+// fnmatch (np. "run*" dla wszystkich folderów o nazwach zaczynających się
+// od "run").
+int tree_find(Tree *tree, const char *path, const char *pattern,
+              TreeVisitor visitor, void *arg, const TreeWalkOptions *opts);
+
+// Pamięć zajmowana przez drzewo, w bajtach faktycznie zaalokowanych przez
+// malloc (razem z jego narzutem na zaokrąglenia).
+typedef struct TreeMemoryUsage {
+    // Liczba folderów (niezmaterializowana kopia z tree_copy liczy się jako
+    // jeden folder, bez poddrzewa, które dzieli ze źródłem)
+    size_t folders;
+    // Struktury wierzchołków bez obiektów synchronizacji
+    size_t node_bytes;
+    // Mutexy i zmienne warunkowe wierzchołków
+    size_t sync_bytes;
+    // Tablice i hashmapy dzieci (jedno dziecko trzymamy w strukturze
+    // wierzchołka)
+    size_t children_bytes;
+    // Stare wersje dzieci trzymane dla snapshotów
+    size_t history_bytes;
+    // Pula długich nazw folderów (wspólna dla wszystkich drzew w procesie)
+    size_t name_bytes;
+    // Suma powyższych
+    size_t total_bytes;
+} TreeMemoryUsage;
+
+// Wypełnia raport o pamięci zajmowanej przez drzewo. Przechodzi drzewo pod
+// readlockami, więc może być wołane współbieżnie z innymi operacjami (ale
+// wtedy raport nie musi odpowiadać żadnej chwili).
+void tree_memory_usage(Tree *tree, TreeMemoryUsage *usage);
+
+// Zmniejsza pamięć zajmowaną przez drzewo po wielu usunięciach: przebudowuje
+// zbiory dzieci w świeżej pamięci (hashmapy, w których zostało nie więcej
+// niż CHILDREN_SMALL dzieci, zamienia na tablice; hashmapy mają stałą
+// liczbę kubełków, więc pozostałe tylko kopiujemy), każdy wierzchołek
+// przenosi do nowej alokacji, a na koniec woła malloc_trim. Przeniesienie
+// to zwykły malloc na wierzchołek — wierzchołki nie trafiają obok siebie,
+// a pomaga tylko wtedy, gdy malloc zapełni nimi dziury po usuniętych
+// i zwolni przez to koniec sterty. Działa przyrostowo — bierze writelock
+// tylko na jeden folder naraz, więc operacje na innych częściach drzewa nie
+// czekają, a czytelnicy danego folderu czekają tylko na przebudowę jego
+// dzieci.
+// Wierzchołków nie przenosi, gdy są aktywne snapshoty lub niezmaterializowane
+// kopie, bo mogą wskazywać na stare adresy.
+void tree_compact(Tree *tree);
+
+// Rodzaje zdarzeń zgłaszanych przez obserwacje folderów.
+typedef enum TreeEventType {
+    TREE_EVENT_CREATED,
+    TREE_EVENT_REMOVED,
+    // Przeniesienie folderu jest zgłaszane jako dwa zdarzenia: ze starą
+    // i z nową ścieżką, z tym samym cookie
+    TREE_EVENT_MOVED_FROM,
+    TREE_EVENT_MOVED_TO,
+    // Część zdarzeń przepadła, bo obserwujący nie nadążał ich odbierać
+    // (cookie to liczba straconych zdarzeń)
+    TREE_EVENT_OVERFLOW
+} TreeEventType;
+
+typedef struct TreeEvent {
+    TreeEventType type;
+    uint64_t cookie;
+    // Ścieżka folderu, którego dotyczy zdarzenie (NULL dla
+    // TREE_EVENT_OVERFLOW), do zwolnienia przez odbierającego
+    char *path;
+} TreeEvent;
+
+// Obserwacja zmian w folderze.
+typedef struct TreeWatch TreeWatch;
+
+// Zaczyna obserwować zmiany dzieci folderu `path`, a jeśli recursive jest
+// prawdą, to także wszystkich jego potomków. Obserwacja dotyczy ścieżki,
+// a nie folderu: folder nie musi istnieć, a po przeniesieniu go obserwacja
+// zostaje przy starej ścieżce. Przeniesienie lub usunięcie folderu jest
+// zgłaszane tylko dla niego samego, a nie dla jego potomków. Zdarzenia są
+// zgłaszane po wykonaniu operacji, ale przed oddaniem jej locków, więc
+// zdarzenia dotyczące dzieci jednego folderu przychodzą w kolejności
+// wykonania operacji. Operacje na folderach, których nie obejmuje żadna
+// obserwacja, tylko czytają filtr obserwowanych ścieżek (zmieniany przy
+// tworzeniu i kończeniu obserwacji), a nie biorą locka rejestru obserwacji
+// ani nic w nim nie zapisują. Zwraca NULL dla niepoprawnej ścieżki.
+TreeWatch *tree_watch(Tree *tree, const char *path, bool recursive);
+
+// Odbiera co najwyżej `max` zdarzeń naraz. Jeśli nie ma żadnych, a wait
+// jest prawdą, czeka na pierwsze. Zwraca liczbę odebranych zdarzeń.
+// Obserwację może odbierać tylko jeden wątek naraz.
+size_t tree_watch_read(TreeWatch *watch, TreeEvent *events, size_t max,
+                       bool wait);
+
+// Zwraca deskryptor, który jest gotowy do czytania (w sensie poll), gdy
+// obserwacja może mieć zdarzenia do odebrania. Nie należy z niego czytać.
+int tree_watch_fd(TreeWatch *watch);
+
+// Kończy obserwację i zwalnia nieodebrane zdarzenia. Wszystkie obserwacje
+// trzeba zakończyć przed tree_free.
+void tree_watch_free(TreeWatch *watch);
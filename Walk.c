@@ -0,0 +1,425 @@
+#include "Walk.h"
+#include <errno.h>
+#include <fnmatch.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Zadanie przejścia poddrzewa wierzchołka. Status czytelnika w wierzchołku
+// zdobywa dopiero wątek, który wziął zadanie, a do tego czasu mamy go
+// w ojcu, więc wierzchołek nie zniknie (wyjątkiem jest wierzchołek, od
+// którego zaczynamy, zablokowany przez start_read).
+typedef struct WalkTask {
+    Node *node;
+    // Czy mamy już status czytelnika w node
+    bool locked;
+    // Zadanie ojca albo NULL dla wierzchołka, od którego zaczynamy
+    struct WalkTask *parent;
+    // Liczba niezakończonych zadań dzieci, plus jeden, dopóki samo zadanie
+    // się nie wykonało. Gdy spadnie do zera, oddajemy readlocka na node
+    // i zmniejszamy licznik ojca — dzięki temu readlocki są oddawane
+    // od dołu i zawsze trzymamy całą ścieżkę do korzenia.
+    size_t pending;
+    // Indeks początku nazwy wierzchołka w path
+    size_t name_offset;
+    char path[];
+} WalkTask;
+
+// Kolejka zadań jednego wątku. Właściciel wkłada i wyjmuje zadania z końca
+// (więc sam przechodzi drzewo w głąb), a pozostałe wątki kradną z początku,
+// czyli zadania najbliżej korzenia, z największymi poddrzewami.
+typedef struct WalkDeque {
+    pthread_mutex_t mutex;
+    WalkTask **tasks;
+    size_t top, bottom, capacity;
+} WalkDeque;
+
+typedef struct Walk {
+    const char *pattern;
+    bool visit_start;
+    TreeVisitor visitor;
+    void *arg;
+    bool serialize;
+    pthread_mutex_t visitor_mutex;
+    WalkDeque *deques;
+    size_t n_workers;
+    // Liczba zadań we wszystkich kolejkach i liczba śpiących wątków.
+    // Oba liczniki są atomowe, a idle zmieniamy dodatkowo pod mutexem, żeby
+    // wkładający zadanie nie obudził nikogo przed jego zaśnięciem.
+    size_t queued;
+    size_t idle;
+    // Chroni done i deferred, na work śpią wątki, które nie mają czego
+    // ukraść
+    pthread_mutex_t mutex;
+    pthread_cond_t work;
+    // Zadania odłożone, bo w ich wierzchołku jest albo czeka pisarz
+    WalkTask **deferred;
+    size_t n_deferred, deferred_capacity;
+    // Czy zakończyło się zadanie wierzchołka, od którego zaczynaliśmy
+    bool done;
+    // Pierwszy niezerowy wynik visitora (atomowy)
+    int result;
+    // Liczba wątków z puli, które jeszcze pracują dla przejścia (chroniona
+    // przez mutex); ostatni budzi wołającego przez finished
+    size_t helping;
+    pthread_cond_t finished;
+} Walk;
+
+typedef struct Worker {
+    Walk *walk;
+    size_t index;
+} Worker;
+
+// Pula wątków pomocniczych wspólna dla wszystkich przejść w procesie.
+// Wątki nie kończą się, więc jest ich tyle, ile najwięcej pomocników
+// pracowało naraz. Nowy wątek tworzymy tylko wtedy, gdy nie ma wolnego,
+// więc każde zlecenie od razu ma swój wątek, a przejście nie czeka na inne.
+static struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t job;
+    // Zlecenia, których nie wziął jeszcze żaden wątek
+    Worker **jobs;
+    size_t n_jobs, capacity;
+    // Liczba wątków czekających na zlecenie, niezarezerwowanych przez
+    // zlecenia z jobs
+    size_t idle;
+} pool = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL, 0, 0, 0};
+
+static void deque_init(WalkDeque *d) {
+    ptry(pthread_mutex_init(&d->mutex, 0));
+    d->tasks = NULL;
+    d->top = d->bottom = d->capacity = 0;
+}
+
+static void deque_destroy(WalkDeque *d) {
+    ptry(pthread_mutex_destroy(&d->mutex));
+    free(d->tasks);
+}
+
+static void deque_push(WalkDeque *d, WalkTask *task) {
+    ptry(pthread_mutex_lock(&d->mutex));
+    if (d->bottom == d->capacity) {
+        if (d->top > 0) {
+            // Najpierw odzyskujemy miejsce po ukradzionych zadaniach
+            memmove(d->tasks, d->tasks + d->top,
+                    (d->bottom - d->top) * sizeof(WalkTask *));
+            d->bottom -= d->top;
+            d->top = 0;
+        } else {
+            d->capacity = d->capacity ? 2 * d->capacity : 16;
+            d->tasks = realloc(d->tasks, d->capacity * sizeof(WalkTask *));
+            if (d->tasks == NULL)
+                fatal("Memory allocation failed");
+        }
+    }
+    d->tasks[d->bottom++] = task;
+    ptry(pthread_mutex_unlock(&d->mutex));
+}
+
+static WalkTask *deque_pop(WalkDeque *d) {
+    WalkTask *task = NULL;
+    ptry(pthread_mutex_lock(&d->mutex));
+    if (d->bottom > d->top)
+        task = d->tasks[--d->bottom];
+    if (d->bottom == d->top)
+        d->top = d->bottom = 0;
+    ptry(pthread_mutex_unlock(&d->mutex));
+    return task;
+}
+
+static WalkTask *deque_steal(WalkDeque *d) {
+    WalkTask *task = NULL;
+    ptry(pthread_mutex_lock(&d->mutex));
+    if (d->bottom > d->top)
+        task = d->tasks[d->top++];
+    ptry(pthread_mutex_unlock(&d->mutex));
+    return task;
+}
+
+static WalkTask *task_new(Node *node, WalkTask *parent, const char *name,
+                          size_t name_length) {
+    size_t offset = parent ? strlen(parent->path) : 0;
+    WalkTask *task = malloc(sizeof(WalkTask) + offset + name_length + 2);
+    if (task == NULL)
+        fatal("Memory allocation failed");
+    task->node = node;
+    task->locked = parent == NULL;
+    task->parent = parent;
+    task->pending = 1;
+    task->name_offset = offset;
+    if (parent)
+        memcpy(task->path, parent->path, offset);
+    memcpy(task->path + offset, name, name_length);
+    strcpy(task->path + offset + name_length, parent ? "/" : "");
+    return task;
+}
+
+static void push(Walk *w, size_t self, WalkTask *task) {
+    deque_push(&w->deques[self], task);
+    __atomic_add_fetch(&w->queued, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&w->idle, __ATOMIC_SEQ_CST) > 0) {
+        ptry(pthread_mutex_lock(&w->mutex));
+        ptry(pthread_cond_signal(&w->work));
+        ptry(pthread_mutex_unlock(&w->mutex));
+    }
+}
+
+static WalkTask *take(Walk *w, size_t self) {
+    WalkTask *task = deque_pop(&w->deques[self]);
+    for (size_t i = 1; task == NULL && i < w->n_workers; i++)
+        task = deque_steal(&w->deques[(self + i) % w->n_workers]);
+    if (task)
+        __atomic_sub_fetch(&w->queued, 1, __ATOMIC_SEQ_CST);
+    return task;
+}
+
+static bool stopped(Walk *w) {
+    return __atomic_load_n(&w->result, __ATOMIC_RELAXED) != 0;
+}
+
+// Kończy zadanie (lub jego część, która była dzieckiem) i te zadania
+// przodków, które przez to się kończą.
+static void finish(Walk *w, WalkTask *task) {
+    while (task && __atomic_sub_fetch(&task->pending, 1,
+                                      __ATOMIC_ACQ_REL) == 0) {
+        WalkTask *parent = task->parent;
+        if (parent) {
+            if (task->locked)
+                release_readlock(task->node);
+        } else {
+            release_held_readlocks(task->node, task->node);
+            ptry(pthread_mutex_lock(&w->mutex));
+            w->done = true;
+            ptry(pthread_cond_broadcast(&w->work));
+            ptry(pthread_mutex_unlock(&w->mutex));
+        }
+        free(task);
+        task = parent;
+    }
+}
+
+static void visit(Walk *w, WalkTask *task) {
+    if (task->parent == NULL && !w->visit_start)
+        return;
+    if (w->pattern) {
+        char name[MAX_FOLDER_NAME_LENGTH + 1];
+        size_t length = strlen(task->path) - task->name_offset - 1;
+        memcpy(name, task->path + task->name_offset, length);
+        name[length] = '\0';
+        if (fnmatch(w->pattern, name, 0) != 0)
+            return;
+    }
+    if (w->serialize) {
+        ptry(pthread_mutex_lock(&w->visitor_mutex));
+    }
+    int result = w->visitor(task->path, w->arg);
+    if (w->serialize) {
+        ptry(pthread_mutex_unlock(&w->visitor_mutex));
+    }
+    int expected = 0;
+    if (result != 0)
+        __atomic_compare_exchange_n(&w->result, &expected, result, false,
+                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+}
+
+// Odkłada zadanie, którego readlocka nie da się teraz zdobyć bez czekania.
+static void defer(Walk *w, WalkTask *task) {
+    ptry(pthread_mutex_lock(&w->mutex));
+    if (w->n_deferred == w->deferred_capacity) {
+        w->deferred_capacity = w->deferred_capacity ?
+                               2 * w->deferred_capacity : 16;
+        w->deferred = realloc(w->deferred,
+                              w->deferred_capacity * sizeof(WalkTask *));
+        if (w->deferred == NULL)
+            fatal("Memory allocation failed");
+    }
+    w->deferred[w->n_deferred++] = task;
+    if (__atomic_load_n(&w->idle, __ATOMIC_SEQ_CST) > 0) {
+        ptry(pthread_cond_signal(&w->work));
+    }
+    ptry(pthread_mutex_unlock(&w->mutex));
+}
+
+// Wyjmuje odłożone zadanie o leksykograficznie największej ścieżce albo
+// zwraca NULL, jeśli nie ma odłożonych. Wymaga mutexa przejścia.
+static WalkTask *undefer(Walk *w) {
+    if (w->n_deferred == 0)
+        return NULL;
+    size_t max = 0;
+    for (size_t i = 1; i < w->n_deferred; i++) {
+        if (strcmp(w->deferred[i]->path, w->deferred[max]->path) > 0)
+            max = i;
+    }
+    WalkTask *task = w->deferred[max];
+    w->deferred[max] = w->deferred[--w->n_deferred];
+    return task;
+}
+
+static void run(Walk *w, size_t self, WalkTask *task) {
+    // Zadania zatrzymanego przejścia, które nie mają jeszcze readlocka,
+    // tylko kończymy.
+    if (task->locked && !stopped(w)) {
+        visit(w, task);
+        Children *children = get_children(task->node);
+        // Licznik zwiększamy przed wrzuceniem pierwszego dziecka, bo inne
+        // wątki mogą je od razu ukraść i zakończyć.
+        __atomic_add_fetch(&task->pending, children_size(children),
+                           __ATOMIC_RELAXED);
+        ChildrenIterator it = children_iterator(children);
+        Name key;
+        void *value;
+        char name[MAX_FOLDER_NAME_LENGTH + 1];
+        while (children_next(children, &it, &key, &value)) {
+            size_t length = name_to_string(key, name);
+            push(w, self, task_new(value, task, name, length));
+        }
+    }
+    finish(w, task);
+}
+
+// Readlocki na dzieciach zdobywamy dopiero po wzięciu zadania i nie czekamy
+// na nie, dopóki jest co innego do zrobienia: przejście trzyma naraz
+// readlocki na wielu gałęziach, a pisarze zdobywają locki w kolejności
+// leksykograficznej, więc czekanie na wierzchołek mniejszy od trzymanego
+// mogłoby zamknąć cykl (np. pisarz przenoszący z /c/x/s/ do /c/z/ czeka
+// na /c/z/, który trzymamy, a my czekamy na /c/x/s/). Gdy wątek nie ma nic
+// innego, czeka na odłożone zadanie o największej ścieżce — wszystko, na
+// co czekają pisarze blokujący to zadanie, jest większe, więc nie może
+// czekać na żadne z pozostałych odłożonych zadań.
+static void work(Walk *w, size_t self) {
+    while (true) {
+        WalkTask *task = take(w, self);
+        if (task) {
+            if (!task->locked && !stopped(w)) {
+                if (!try_readlock(task->node)) {
+                    defer(w, task);
+                    continue;
+                }
+                task->locked = true;
+            }
+            run(w, self, task);
+            continue;
+        }
+        ptry(pthread_mutex_lock(&w->mutex));
+        if ((task = undefer(w))) {
+            ptry(pthread_mutex_unlock(&w->mutex));
+            if (!stopped(w)) {
+                get_readlock(task->node);
+                task->locked = true;
+            }
+            run(w, self, task);
+            continue;
+        }
+        __atomic_add_fetch(&w->idle, 1, __ATOMIC_SEQ_CST);
+        while (!w->done && w->n_deferred == 0 &&
+               __atomic_load_n(&w->queued, __ATOMIC_SEQ_CST) == 0)
+            ptry(pthread_cond_wait(&w->work, &w->mutex));
+        __atomic_sub_fetch(&w->idle, 1, __ATOMIC_SEQ_CST);
+        bool done = w->done;
+        ptry(pthread_mutex_unlock(&w->mutex));
+        if (done)
+            return;
+    }
+}
+
+static void help(Worker *worker) {
+    Walk *w = worker->walk;
+    work(w, worker->index);
+    // Po oddaniu mutexa wołający może już zwolnić przejście
+    ptry(pthread_mutex_lock(&w->mutex));
+    if (--w->helping == 0) {
+        ptry(pthread_cond_signal(&w->finished));
+    }
+    ptry(pthread_mutex_unlock(&w->mutex));
+}
+
+static void *pool_thread(void *data) {
+    (void) data;
+    ptry(pthread_mutex_lock(&pool.mutex));
+    while (true) {
+        while (pool.n_jobs == 0)
+            ptry(pthread_cond_wait(&pool.job, &pool.mutex));
+        Worker *worker = pool.jobs[--pool.n_jobs];
+        ptry(pthread_mutex_unlock(&pool.mutex));
+        help(worker);
+        ptry(pthread_mutex_lock(&pool.mutex));
+        pool.idle++;
+    }
+    return NULL;
+}
+
+// Zleca wątkowi z puli pracę dla przejścia, w razie potrzeby tworząc wątek.
+static void pool_submit(Worker *worker) {
+    ptry(pthread_mutex_lock(&pool.mutex));
+    if (pool.n_jobs == pool.capacity) {
+        pool.capacity = pool.capacity ? 2 * pool.capacity : 16;
+        pool.jobs = realloc(pool.jobs, pool.capacity * sizeof(Worker *));
+        if (pool.jobs == NULL)
+            fatal("Memory allocation failed");
+    }
+    pool.jobs[pool.n_jobs++] = worker;
+    if (pool.idle > 0) {
+        pool.idle--;
+        ptry(pthread_cond_signal(&pool.job));
+    } else {
+        pthread_t thread;
+        pthread_attr_t attr;
+        ptry(pthread_attr_init(&attr));
+        ptry(pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED));
+        ptry(pthread_create(&thread, &attr, pool_thread, NULL));
+        ptry(pthread_attr_destroy(&attr));
+    }
+    ptry(pthread_mutex_unlock(&pool.mutex));
+}
+
+int walk_subtree(Node *root, const char *path, const char *pattern,
+                 bool visit_start, TreeVisitor visitor, void *arg,
+                 const TreeWalkOptions *opts) {
+    // Protokół wstępny — dalsze readlocki zdobywamy już, schodząc w dół
+    if (!start_read(root, path))
+        return ENOENT;
+    Walk w;
+    w.pattern = pattern;
+    w.visit_start = visit_start;
+    w.visitor = visitor;
+    w.arg = arg;
+    w.serialize = opts && opts->serialize;
+    w.n_workers = opts && opts->threads > 1 ? opts->threads : 1;
+    w.queued = w.idle = 0;
+    w.done = false;
+    w.result = 0;
+    w.deferred = NULL;
+    w.n_deferred = w.deferred_capacity = 0;
+    w.helping = w.n_workers - 1;
+    w.deques = malloc(w.n_workers * sizeof(WalkDeque));
+    Worker *workers = malloc(w.n_workers * sizeof(Worker));
+    if (w.deques == NULL || workers == NULL)
+        fatal("Memory allocation failed");
+    ptry(pthread_mutex_init(&w.visitor_mutex, 0));
+    ptry(pthread_mutex_init(&w.mutex, 0));
+    ptry(pthread_cond_init(&w.work, 0));
+    ptry(pthread_cond_init(&w.finished, 0));
+    for (size_t i = 0; i < w.n_workers; i++)
+        deque_init(&w.deques[i]);
+    push(&w, 0, task_new(get_node(root, path), NULL, path, strlen(path)));
+    // Wołający jest wątkiem numer 0, pozostałe bierzemy z puli
+    for (size_t i = 1; i < w.n_workers; i++) {
+        workers[i].walk = &w;
+        workers[i].index = i;
+        pool_submit(&workers[i]);
+    }
+    work(&w, 0);
+    ptry(pthread_mutex_lock(&w.mutex));
+    while (w.helping > 0)
+        ptry(pthread_cond_wait(&w.finished, &w.mutex));
+    ptry(pthread_mutex_unlock(&w.mutex));
+    for (size_t i = 0; i < w.n_workers; i++)
+        deque_destroy(&w.deques[i]);
+    ptry(pthread_cond_destroy(&w.finished));
+    ptry(pthread_cond_destroy(&w.work));
+    ptry(pthread_mutex_destroy(&w.mutex));
+    ptry(pthread_mutex_destroy(&w.visitor_mutex));
+    free(workers);
+    free(w.deferred);
+    free(w.deques);
+    return w.result;
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include "Node.h"
+#include "Tree.h"
+
+// Przechodzi poddrzewo wierzchołka o ścieżce `path` (w drzewie o korzeniu
+// root) tak, jak opisuje tree_walk. Jeśli pattern nie jest NULL, woła
+// visitor tylko dla wierzchołków o nazwach pasujących do wzorca, a jeśli
+// visit_start jest fałszem, to pomija sam wierzchołek `path`. Ścieżka musi
+// być poprawna.
+int walk_subtree(Node *root, const char *path, const char *pattern,
+                 bool visit_start, TreeVisitor visitor, void *arg,
+                 const TreeWalkOptions *opts);
@@ -0,0 +1,339 @@
+#include "Watch.h"
+#include "Node.h"
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+// Liczba zdarzeń mieszczących się w buforze obserwacji (potęga dwójki).
+#define WATCH_CAPACITY 1024
+
+// Liczba liczników w filtrze obserwowanych ścieżek
+#define FILTER_SIZE 1024
+
+// Miejsce w buforze. Pole seq mówi, czyja jest teraz kolej: równe pozycji
+// pos (licząc od początku istnienia bufora) oznacza wolne miejsce dla
+// zdarzenia o numerze pos, a równe pos + 1 — zdarzenie gotowe do odebrania.
+typedef struct WatchSlot {
+    size_t seq;
+    TreeEventType type;
+    uint64_t cookie;
+    char *path;
+} WatchSlot;
+
+struct TreeWatch {
+    Watches *watches;
+    char *path;
+    size_t length;
+    bool recursive;
+    // Hasz ścieżki i następna obserwacja w kubełku rejestru
+    uint64_t hash;
+    struct TreeWatch *next;
+    // Bufor cykliczny z wieloma piszącymi i jednym czytającym, bez locków
+    // (jak kolejka ograniczona Vyukova). Piszący rezerwują miejsca przez
+    // CAS na head, a czytający jest jedynym, który zmienia tail.
+    WatchSlot slots[WATCH_CAPACITY];
+    size_t head;
+    size_t tail;
+    // Liczba zdarzeń, które nie zmieściły się w buforze (atomowa)
+    size_t lost;
+    // Eventfd, przez który budzimy czytającego, i flaga, czy czytający
+    // opróżnił bufor i czeka na sygnał. Piszący, który ją zgasi, pisze do
+    // eventfd — dzięki temu przy zdarzeniach przychodzących szybciej, niż
+    // są odbierane, nie robimy wywołania systemowego przy każdym.
+    int fd;
+    bool armed;
+};
+
+struct Watches {
+    // Liczby obserwacji nierekurencyjnych i rekurencyjnych według haszy
+    // ich ścieżek modulo FILTER_SIZE (atomowe, zmieniane pod lock do
+    // pisania). Zgłaszający zdarzenie najpierw sprawdza w nich ścieżki
+    // przodków i jeśli żadnej nie ma, kończy bez brania locka — dzięki
+    // temu operacje na nieobserwowanych częściach drzewa niczego wspólnego
+    // nie zapisują.
+    size_t direct[FILTER_SIZE];
+    size_t recursive[FILTER_SIZE];
+    // Zgłaszający zdarzenia trzymają go do czytania, a dodawanie i usuwanie
+    // obserwacji do pisania.
+    pthread_rwlock_t lock;
+    // Tablica haszująca obserwacji według ścieżek
+    TreeWatch **buckets;
+    size_t n_buckets;
+    // Liczba obserwacji; zmieniana pod lock, ale czytana też bez niego
+    size_t count;
+    // Licznik cookie dla przeniesień (atomowy)
+    uint64_t cookies;
+};
+
+#define HASH_INIT 14695981039346656037ULL
+
+// Krok haszowania napisu (FNV-1a). Haszując ścieżkę znak po znaku, mamy
+// po drodze hasze wszystkich jej przodków.
+static uint64_t hash_step(uint64_t hash, char c) {
+    return (hash ^ (unsigned char) c) * 1099511628211ULL;
+}
+
+Watches *watches_new(void) {
+    Watches *w = malloc(sizeof(Watches));
+    if (w == NULL)
+        fatal("Memory allocation failed");
+    ptry(pthread_rwlock_init(&w->lock, 0));
+    w->n_buckets = 16;
+    w->buckets = calloc(w->n_buckets, sizeof(TreeWatch *));
+    if (w->buckets == NULL)
+        fatal("Memory allocation failed");
+    w->count = 0;
+    w->cookies = 0;
+    memset(w->direct, 0, sizeof(w->direct));
+    memset(w->recursive, 0, sizeof(w->recursive));
+    return w;
+}
+
+void watches_free(Watches *w) {
+    if (w->count != 0)
+        fatal("Tree freed with active watches");
+    ptry(pthread_rwlock_destroy(&w->lock));
+    free(w->buckets);
+    free(w);
+}
+
+bool watches_active(Watches *w) {
+    return __atomic_load_n(&w->count, __ATOMIC_ACQUIRE) != 0;
+}
+
+uint64_t watches_cookie(Watches *w) {
+    return __atomic_add_fetch(&w->cookies, 1, __ATOMIC_RELAXED);
+}
+
+// Wkłada zdarzenie do bufora obserwacji i, jeśli trzeba, budzi czytającego.
+static void watch_push(TreeWatch *watch, TreeEventType type, const char *path,
+                       uint64_t cookie) {
+    size_t pos = __atomic_load_n(&watch->head, __ATOMIC_RELAXED);
+    WatchSlot *slot;
+    while (true) {
+        slot = &watch->slots[pos % WATCH_CAPACITY];
+        size_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        if (seq == pos) {
+            if (__atomic_compare_exchange_n(&watch->head, &pos, pos + 1, true,
+                                            __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED))
+                break;
+        } else if (seq < pos) {
+            // Miejsce zajmuje jeszcze nieodebrane zdarzenie sprzed
+            // WATCH_CAPACITY pozycji, czyli bufor jest pełny.
+            __atomic_add_fetch(&watch->lost, 1, __ATOMIC_RELAXED);
+            return;
+        } else {
+            pos = __atomic_load_n(&watch->head, __ATOMIC_RELAXED);
+        }
+    }
+    slot->type = type;
+    slot->cookie = cookie;
+    slot->path = strdup(path);
+    if (slot->path == NULL)
+        fatal("Memory allocation failed");
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+    // Para z barierą w watch_empty: albo czytający zobaczy zdarzenie,
+    // albo my zobaczymy zapaloną flagę.
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&watch->armed, __ATOMIC_RELAXED) &&
+        __atomic_exchange_n(&watch->armed, false, __ATOMIC_RELAXED)) {
+        uint64_t one = 1;
+        if (write(watch->fd, &one, sizeof(one)) != sizeof(one))
+            syserr("Error in write");
+    }
+}
+
+// Długość ścieżki rodzica folderu (bez nazwy folderu i ukośnika na końcu).
+static size_t parent_length(const char *path) {
+    size_t parent = strlen(path) - 1;
+    while (parent > 0 && path[parent - 1] != '/')
+        parent--;
+    return parent;
+}
+
+// Czy według filtra obserwacja ścieżki path[0..length) o podanym haszu może
+// dostać zdarzenie dotyczące dziecka folderu o ścieżce path[0..parent).
+static bool filter_hit(Watches *w, uint64_t hash, size_t length,
+                       size_t parent) {
+    return __atomic_load_n(&w->recursive[hash % FILTER_SIZE],
+                           __ATOMIC_ACQUIRE) > 0 ||
+           (length == parent &&
+            __atomic_load_n(&w->direct[hash % FILTER_SIZE],
+                            __ATOMIC_ACQUIRE) > 0);
+}
+
+bool watches_covered(Watches *w, const char *path) {
+    if (!watches_active(w))
+        return false;
+    size_t parent = parent_length(path);
+    uint64_t hash = HASH_INIT;
+    for (size_t i = 0; i < parent; i++) {
+        hash = hash_step(hash, path[i]);
+        if (path[i] == '/' && filter_hit(w, hash, i + 1, parent))
+            return true;
+    }
+    return false;
+}
+
+void watches_post(Watches *w, TreeEventType type, const char *path,
+                  uint64_t cookie) {
+    if (!watches_covered(w, path))
+        return;
+    size_t parent = parent_length(path);
+    ptry(pthread_rwlock_rdlock(&w->lock));
+    uint64_t hash = HASH_INIT;
+    for (size_t i = 0; i < parent; i++) {
+        hash = hash_step(hash, path[i]);
+        // path[0..i] to ścieżka przodka; zdarzenie dostają wszystkie jego
+        // obserwacje, jeśli to rodzic, a wpp tylko rekurencyjne.
+        size_t length = i + 1;
+        if (path[i] != '/' || !filter_hit(w, hash, length, parent))
+            continue;
+        for (TreeWatch *watch = w->buckets[hash % w->n_buckets]; watch;
+             watch = watch->next) {
+            if (watch->hash == hash && watch->length == length &&
+                (watch->recursive || length == parent) &&
+                memcmp(watch->path, path, length) == 0)
+                watch_push(watch, type, path, cookie);
+        }
+    }
+    ptry(pthread_rwlock_unlock(&w->lock));
+}
+
+// Liczniki filtra, do których należy obserwacja.
+static size_t *filter_slot(TreeWatch *watch) {
+    Watches *w = watch->watches;
+    return watch->recursive ? &w->recursive[watch->hash % FILTER_SIZE] :
+                              &w->direct[watch->hash % FILTER_SIZE];
+}
+
+// Podwaja liczbę kubełków. Wymaga locka rejestru do pisania.
+static void rehash(Watches *w) {
+    size_t n_buckets = 2 * w->n_buckets;
+    TreeWatch **buckets = calloc(n_buckets, sizeof(TreeWatch *));
+    if (buckets == NULL)
+        fatal("Memory allocation failed");
+    for (size_t h = 0; h < w->n_buckets; h++) {
+        while (w->buckets[h]) {
+            TreeWatch *watch = w->buckets[h];
+            w->buckets[h] = watch->next;
+            watch->next = buckets[watch->hash % n_buckets];
+            buckets[watch->hash % n_buckets] = watch;
+        }
+    }
+    free(w->buckets);
+    w->buckets = buckets;
+    w->n_buckets = n_buckets;
+}
+
+TreeWatch *watch_new(Watches *w, const char *path, bool recursive) {
+    TreeWatch *watch = malloc(sizeof(TreeWatch));
+    if (watch == NULL || (watch->path = strdup(path)) == NULL)
+        fatal("Memory allocation failed");
+    watch->watches = w;
+    watch->length = strlen(path);
+    watch->recursive = recursive;
+    watch->hash = HASH_INIT;
+    for (size_t i = 0; i < watch->length; i++)
+        watch->hash = hash_step(watch->hash, path[i]);
+    for (size_t i = 0; i < WATCH_CAPACITY; i++)
+        watch->slots[i].seq = i;
+    watch->head = watch->tail = 0;
+    watch->lost = 0;
+    watch->armed = true;
+    if ((watch->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1)
+        syserr("Error in eventfd");
+    ptry(pthread_rwlock_wrlock(&w->lock));
+    if (w->count >= 2 * w->n_buckets)
+        rehash(w);
+    watch->next = w->buckets[watch->hash % w->n_buckets];
+    w->buckets[watch->hash % w->n_buckets] = watch;
+    __atomic_add_fetch(filter_slot(watch), 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&w->count, w->count + 1, __ATOMIC_RELEASE);
+    ptry(pthread_rwlock_unlock(&w->lock));
+    return watch;
+}
+
+// Wyjmuje z bufora najstarsze zdarzenie, jeśli jakieś jest gotowe.
+static bool watch_pop(TreeWatch *watch, TreeEvent *event) {
+    size_t pos = watch->tail;
+    WatchSlot *slot = &watch->slots[pos % WATCH_CAPACITY];
+    if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != pos + 1)
+        return false;
+    event->type = slot->type;
+    event->cookie = slot->cookie;
+    event->path = slot->path;
+    __atomic_store_n(&slot->seq, pos + WATCH_CAPACITY, __ATOMIC_RELEASE);
+    watch->tail = pos + 1;
+    return true;
+}
+
+// Wołane przez czytającego, który opróżnił bufor: zeruje eventfd i zapala
+// flagę, a potem sprawdza, czy bufor nadal jest pusty (bo piszący mógł
+// włożyć zdarzenie, zanim flaga została zapalona).
+static bool watch_empty(TreeWatch *watch) {
+    uint64_t value;
+    if (read(watch->fd, &value, sizeof(value)) == -1 && errno != EAGAIN)
+        syserr("Error in read");
+    __atomic_store_n(&watch->armed, true, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    WatchSlot *slot = &watch->slots[watch->tail % WATCH_CAPACITY];
+    return __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != watch->tail + 1;
+}
+
+size_t tree_watch_read(TreeWatch *watch, TreeEvent *events, size_t max,
+                       bool wait) {
+    size_t n = 0;
+    while (n < max) {
+        if (watch_pop(watch, &events[n])) {
+            n++;
+            continue;
+        }
+        // Bufor jest pusty, więc wszystko, co się nie zmieściło, zgłaszamy
+        // po odebranych zdarzeniach.
+        size_t lost = __atomic_exchange_n(&watch->lost, 0, __ATOMIC_RELAXED);
+        if (lost > 0) {
+            events[n].type = TREE_EVENT_OVERFLOW;
+            events[n].cookie = lost;
+            events[n].path = NULL;
+            n++;
+            continue;
+        }
+        if (!watch_empty(watch))
+            continue;
+        if (n > 0 || !wait)
+            break;
+        struct pollfd pfd = {watch->fd, POLLIN, 0};
+        if (poll(&pfd, 1, -1) == -1 && errno != EINTR)
+            syserr("Error in poll");
+    }
+    return n;
+}
+
+int tree_watch_fd(TreeWatch *watch) {
+    return watch->fd;
+}
+
+void tree_watch_free(TreeWatch *watch) {
+    Watches *w = watch->watches;
+    ptry(pthread_rwlock_wrlock(&w->lock));
+    TreeWatch **pw = &w->buckets[watch->hash % w->n_buckets];
+    while (*pw != watch)
+        pw = &(*pw)->next;
+    *pw = watch->next;
+    __atomic_sub_fetch(filter_slot(watch), 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&w->count, w->count - 1, __ATOMIC_RELEASE);
+    ptry(pthread_rwlock_unlock(&w->lock));
+    // Teraz nikt już nie pisze do bufora.
+    TreeEvent event;
+    while (watch_pop(watch, &event))
+        free(event.path);
+    if (close(watch->fd) == -1)
+        syserr("Error in close");
+    free(watch->path);
+    free(watch);
+}
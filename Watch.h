@@ -0,0 +1,34 @@
+#pragma once
+
+#include "Tree.h"
+
+// Rejestr obserwacji jednego drzewa. Operacje zgłaszają zdarzenia przez
+// watches_post, które wkłada je do bufora każdej pasującej obserwacji.
+typedef struct Watches Watches;
+
+Watches *watches_new(void);
+
+// Zwalnia rejestr. Nie może on już zawierać żadnych obserwacji.
+void watches_free(Watches *);
+
+// Czy jest jakakolwiek obserwacja. Pozwala operacjom pominąć przygotowanie
+// zdarzeń, gdy nikt ich nie odbierze.
+bool watches_active(Watches *);
+
+// Czy jakaś obserwacja może dostać zdarzenie dotyczące folderu o ścieżce
+// `path` (może zwrócić prawdę niepotrzebnie, ale nigdy fałsz, gdy taka
+// obserwacja jest). Nie bierze żadnych locków i niczego nie zapisuje.
+bool watches_covered(Watches *, const char *path);
+
+// Zwraca nowe cookie dla pary zdarzeń przeniesienia.
+uint64_t watches_cookie(Watches *);
+
+// Zgłasza zdarzenie dotyczące folderu o ścieżce `path` obserwacjom jego
+// rodzica i rekurencyjnym obserwacjom jego przodków. Nie bierze żadnych
+// locków drzewa, więc można je wołać pod writelockami operacji. Lock
+// rejestru bierze tylko wtedy, gdy watches_covered(path).
+void watches_post(Watches *, TreeEventType type, const char *path,
+                  uint64_t cookie);
+
+// Tworzy obserwację w rejestrze (ścieżka musi być poprawna).
+TreeWatch *watch_new(Watches *, const char *path, bool recursive);
@@ -0,0 +1,256 @@
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+#include "AsyncTree.h"
+#include "Tree.h"
+
+// Mikrobenchmark operacji modyfikujących drzewo. Użycie: bench [wątki]
+// [sekundy].
+// Każdy scenariusz trwa podaną liczbę sekund, a na koniec wypisuje liczbę
+// operacji na sekundę, sumarycznie dla wszystkich wątków, i średnią liczbę
+// przełączeń kontekstu na operację (według getrusage dla całego procesu).
+
+// Liczba folderów, które wątek w scenariuszach tworzenia i usuwania tworzy,
+// zanim zacznie je usuwać (i liczba żądań na wątek roboczy w kolejce).
+#define WINDOW 8
+
+typedef enum ScenarioKind {
+    // Wątki przenoszą folder z `from` do `to` i z powrotem
+    BENCH_MOVE,
+    // Wątki tworzą i usuwają po WINDOW dzieci folderu /shared/
+    BENCH_CREATE_REMOVE,
+    // To samo, ale wszystkie operacje zgłasza jedna pętla zdarzeń przez
+    // TreeQueue, a wykonuje je tyle wątków roboczych, ile było wątków
+    BENCH_QUEUE
+} ScenarioKind;
+
+typedef struct Scenario {
+    const char *name;
+    ScenarioKind kind;
+    // Ścieżki, między którymi wątek przenosi folder tam i z powrotem
+    // (%c zastępujemy literą wątku)
+    const char *from, *to;
+} Scenario;
+
+static const Scenario scenarios[] = {
+    // Zmiana nazwy w folderze, w którym pracuje tylko jeden wątek
+    {"rename (own folder)", BENCH_MOVE, "/own/%c/x/", "/own/%c/y/"},
+    // Zmiana nazwy w folderze wspólnym dla wszystkich wątków
+    {"rename (shared folder)", BENCH_MOVE, "/shared/x%c/", "/shared/y%c/"},
+    // Przeniesienie między dwoma folderami wątku, dla porównania
+    {"move (two folders)", BENCH_MOVE, "/own/%c/x/", "/own/%c/z/x/"},
+    // Tworzenie i usuwanie w folderze wspólnym bezpośrednio i przez kolejkę,
+    // która grupuje operacje na tym samym rodzicu (żeby zmierzyć koszt
+    // kolejki względem bezpośrednich wywołań)
+    {"create/remove (direct)", BENCH_CREATE_REMOVE, NULL, NULL},
+    {"create/remove (queue)", BENCH_QUEUE, NULL, NULL},
+};
+
+// Ścieżka i-tego folderu tworzonego w scenariuszach tworzenia i usuwania
+// (wątek i / WINDOW, jego folder numer i % WINDOW).
+static void shared_path(char *path, size_t size, size_t i) {
+    snprintf(path, size, "/shared/%c%c/", (char) ('a' + i / WINDOW),
+             (char) ('a' + i % WINDOW));
+}
+
+static void check(int result, const char *operation, const char *path) {
+    if (result != 0) {
+        fprintf(stderr, "bench: %s %s failed\n", operation, path);
+        exit(1);
+    }
+}
+
+typedef struct Worker {
+    Tree *tree;
+    const Scenario *scenario;
+    char letter;
+    volatile bool *stop;
+    unsigned long ops;
+} Worker;
+
+static void *create_remove_worker(Worker *w) {
+    char paths[WINDOW][32];
+    for (size_t i = 0; i < WINDOW; i++)
+        shared_path(paths[i], sizeof(paths[i]), (w->letter - 'a') * WINDOW + i);
+    unsigned long ops = 0;
+    while (!__atomic_load_n(w->stop, __ATOMIC_RELAXED)) {
+        for (size_t i = 0; i < WINDOW; i++)
+            check(tree_create(w->tree, paths[i]), "tree_create", paths[i]);
+        for (size_t i = 0; i < WINDOW; i++)
+            check(tree_remove(w->tree, paths[i]), "tree_remove", paths[i]);
+        ops += 2 * WINDOW;
+    }
+    w->ops = ops;
+    return NULL;
+}
+
+static void *worker(void *data) {
+    Worker *w = data;
+    if (w->scenario->kind == BENCH_CREATE_REMOVE)
+        return create_remove_worker(w);
+    char from[32], to[32];
+    snprintf(from, sizeof(from), w->scenario->from, w->letter);
+    snprintf(to, sizeof(to), w->scenario->to, w->letter);
+    unsigned long ops = 0;
+    while (!__atomic_load_n(w->stop, __ATOMIC_RELAXED)) {
+        if (tree_move(w->tree, from, to) != 0 ||
+            tree_move(w->tree, to, from) != 0) {
+            fprintf(stderr, "bench: tree_move %s failed\n", from);
+            exit(1);
+        }
+        ops += 2;
+    }
+    w->ops = ops;
+    return NULL;
+}
+
+// Pętla zdarzeń scenariusza BENCH_QUEUE: trzyma w kolejce po jednym żądaniu
+// dla każdego z n_threads * WINDOW folderów, na zmianę tworząc je i usuwając.
+// Zwraca liczbę wykonanych operacji.
+static unsigned long run_queue(Tree *tree, size_t n_threads, int seconds) {
+    size_t n = n_threads * WINDOW;
+    TreeQueue *queue = tree_queue_new(tree, n_threads, n);
+    char (*paths)[32] = malloc(n * sizeof(*paths));
+    bool *present = calloc(n, sizeof(bool));
+    TreeRequest *requests = malloc(n * sizeof(TreeRequest));
+    TreeCompletion *completions = malloc(n * sizeof(TreeCompletion));
+    if (paths == NULL || present == NULL || requests == NULL ||
+        completions == NULL) {
+        fprintf(stderr, "bench: out of memory\n");
+        exit(1);
+    }
+    for (size_t i = 0; i < n; i++) {
+        shared_path(paths[i], sizeof(paths[i]), i);
+        requests[i] = (TreeRequest) {TREE_CREATE, paths[i], NULL,
+                                     (void *) i};
+    }
+    // Kolejka ma miejsce na wszystkie żądania, więc zawsze je przyjmuje.
+    tree_queue_submit(queue, requests, n);
+    struct timespec now, end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    end.tv_sec += seconds;
+    unsigned long ops = 0;
+    size_t in_flight = n;
+    bool stop = false;
+    while (in_flight > 0) {
+        struct pollfd pfd = {tree_queue_fd(queue), POLLIN, 0};
+        uint64_t count;
+        if (poll(&pfd, 1, -1) < 0 ||
+            read(pfd.fd, &count, sizeof(count)) != sizeof(count)) {
+            perror("bench");
+            exit(1);
+        }
+        size_t reaped = tree_queue_reap(queue, completions, n), m = 0;
+        in_flight -= reaped;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        stop = stop || now.tv_sec > end.tv_sec ||
+               (now.tv_sec == end.tv_sec && now.tv_nsec >= end.tv_nsec);
+        for (size_t k = 0; k < reaped; k++) {
+            size_t i = (size_t) completions[k].user_data;
+            check(completions[k].result,
+                  present[i] ? "tree_remove" : "tree_create", paths[i]);
+            present[i] = !present[i];
+            ops++;
+            if (!stop) {
+                requests[m++] = (TreeRequest) {
+                        present[i] ? TREE_REMOVE : TREE_CREATE, paths[i],
+                        NULL, (void *) i};
+            }
+        }
+        in_flight += tree_queue_submit(queue, requests, m);
+    }
+    tree_queue_free(queue);
+    free(completions);
+    free(requests);
+    free(present);
+    free(paths);
+    return ops;
+}
+
+typedef struct Result {
+    double ops_per_second;
+    double switches_per_op;
+} Result;
+
+static long context_switches(void) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_nvcsw + usage.ru_nivcsw;
+}
+
+static Result run(const Scenario *scenario, size_t n_threads, int seconds) {
+    Tree *tree = tree_new();
+    char path[32];
+    tree_create(tree, "/own/");
+    tree_create(tree, "/shared/");
+    for (size_t i = 0; i < n_threads; i++) {
+        char letter = 'a' + i;
+        snprintf(path, sizeof(path), "/own/%c/", letter);
+        tree_create(tree, path);
+        snprintf(path, sizeof(path), "/own/%c/z/", letter);
+        tree_create(tree, path);
+        if (scenario->kind == BENCH_MOVE) {
+            snprintf(path, sizeof(path), scenario->from, letter);
+            tree_create(tree, path);
+        }
+        // Kilka innych dzieci, żeby zbiór dzieci był hashmapą
+        for (char c = 'a'; c <= 'h'; c++) {
+            snprintf(path, sizeof(path), "/own/%c/%c%c/", letter, c, c);
+            tree_create(tree, path);
+        }
+    }
+    volatile bool stop = false;
+    pthread_t *threads = malloc(n_threads * sizeof(pthread_t));
+    Worker *workers = malloc(n_threads * sizeof(Worker));
+    if (threads == NULL || workers == NULL) {
+        fprintf(stderr, "bench: out of memory\n");
+        exit(1);
+    }
+    struct timespec start, end;
+    long switches = context_switches();
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    unsigned long ops = 0;
+    if (scenario->kind == BENCH_QUEUE) {
+        ops = run_queue(tree, n_threads, seconds);
+    } else {
+        for (size_t i = 0; i < n_threads; i++) {
+            workers[i] = (Worker) {tree, scenario, 'a' + i, &stop, 0};
+            pthread_create(&threads[i], NULL, worker, &workers[i]);
+        }
+        sleep(seconds);
+        __atomic_store_n(&stop, true, __ATOMIC_RELAXED);
+        for (size_t i = 0; i < n_threads; i++) {
+            pthread_join(threads[i], NULL);
+            ops += workers[i].ops;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    // Wliczają się też przełączenia wątku głównego (sleep i pthread_join),
+    // ale to tylko kilka na cały scenariusz.
+    switches = context_switches() - switches;
+    double elapsed = (end.tv_sec - start.tv_sec) +
+                     (end.tv_nsec - start.tv_nsec) / 1e9;
+    free(workers);
+    free(threads);
+    tree_free(tree);
+    return (Result) {ops / elapsed, (double) switches / ops};
+}
+
+int main(int argc, char *argv[]) {
+    size_t n_threads = argc > 1 ? strtoul(argv[1], NULL, 10) : 4;
+    int seconds = argc > 2 ? atoi(argv[2]) : 2;
+    if (n_threads < 1 || n_threads > 26 || seconds < 1) {
+        fprintf(stderr, "usage: %s [threads (1-26)] [seconds]\n", argv[0]);
+        return 1;
+    }
+    for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++) {
+        Result result = run(&scenarios[i], n_threads, seconds);
+        printf("%-24s %12.0f ops/s %10.4f switches/op\n", scenarios[i].name,
+               result.ops_per_second, result.switches_per_op);
+    }
+    return 0;
+}
@@ -89,17 +89,22 @@ const char** make_map_contents_array(HashMap* map)
 char* make_map_contents_string(HashMap* map)
 {
     const char** keys = make_map_contents_array(map);
+    char* result = make_contents_string(keys);
+    free(keys);
+    return result;
+}
 
+char* make_contents_string(const char** keys)
+{
     unsigned int result_size = 0; // Including ending null character.
     for (const char** key = keys; *key; ++key)
         result_size += strlen(*key) + 1;
 
-    // Return empty string if map is empty.
+    // Return empty string if there are no keys.
     if (!result_size) {
         // Note we can't just return "", as it can't be free'd.
         char* result = malloc(1);
         *result = '\0';
-        free(keys);
         return result;
     }
 
@@ -115,6 +120,5 @@ char* make_map_contents_string(HashMap* map)
     }
     position--;
     *position = '\0';
-    free(keys);
     return result;
 }
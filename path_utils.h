@@ -49,3 +49,9 @@ const char** make_map_contents_array(HashMap* map);
 // The result has no trailing comma. An empty map yields an empty string.
 // The caller should free the result.
 char* make_map_contents_string(HashMap* map);
+
+// Return a string containing the given keys in order, comma-separated.
+// `keys` should be a null-terminated array.
+// The result has no trailing comma. An empty array yields an empty string.
+// The caller should free the result.
+char* make_contents_string(const char** keys);
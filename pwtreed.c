@@ -0,0 +1,510 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "AsyncTree.h"
+#include "err.h"
+#include "path_utils.h"
+#include "pwtreed.h"
+
+// Serwer drzewa na gnieździe uniksowym. Jeden wątek obsługuje wszystkie
+// połączenia przez epoll: czyta naraz wszystko, co przyszło, zgłasza
+// wszystkie odczytane żądania jednym tree_queue_submit, a odpowiedzi
+// z kolejki zakończeń zbiera i wysyła do każdego klienta jednym zapisem.
+// Operacje na drzewie wykonuje stała pula wątków TreeQueue.
+
+#define DEFAULT_WORKERS 4
+#define QUEUE_CAPACITY 4096
+// Powyżej tylu żądań czekających na miejsce w kolejce przestajemy czytać
+// od klientów, dopóki kolejka się nie opróżni.
+#define BACKLOG_LIMIT (4 * QUEUE_CAPACITY)
+// Powyżej tylu bajtów niewysłanych odpowiedzi przestajemy czytać od klienta,
+// który ich nie odbiera, dopóki nie zejdzie poniżej połowy.
+#define OUTPUT_LIMIT (1 << 20)
+#define MAX_EVENTS 64
+#define REAP_BATCH 256
+#define READ_CHUNK 65536
+
+typedef struct Buffer {
+    char *data;
+    size_t start, size, capacity;
+} Buffer;
+
+typedef struct Connection {
+    int fd;
+    Buffer in, out;
+    // Liczba żądań, na które jeszcze nie odpowiedzieliśmy
+    size_t pending;
+    // Czy klient zamknął swoją stronę (wtedy kończymy po wysłaniu
+    // wszystkich odpowiedzi) i czy zamknęliśmy już deskryptor
+    bool eof, closed;
+    // Czy nie czytamy z powodu przepełnienia kolejki albo bufora odpowiedzi
+    // tego klienta, czy czekamy na możliwość zapisu i czy są nowe
+    // odpowiedzi do wysłania w tym obrocie pętli
+    bool paused, blocked, want_write, dirty;
+    struct Connection *prev, *next, *next_dirty;
+} Connection;
+
+// Żądanie w trakcie wykonywania, przekazywane jako user_data.
+typedef struct Call {
+    Connection *conn;
+    uint32_t id;
+    char strings[];
+} Call;
+
+typedef struct Server {
+    Tree *tree;
+    TreeQueue *queue;
+    int listen_fd, epoll_fd, signal_fd, queue_fd;
+    // Żądania odczytane, ale jeszcze nieprzyjęte przez kolejkę
+    TreeRequest *backlog;
+    size_t backlog_start, backlog_size, backlog_capacity;
+    // Liczba żądań przyjętych przez kolejkę, ale jeszcze nieodebranych
+    size_t in_flight;
+    bool paused;
+    Connection *connections, *dirty;
+} Server;
+
+// Znaczniki w epoll_event.data.ptr dla deskryptorów innych niż połączenia.
+static char listen_tag, queue_tag, signal_tag;
+
+static void buffer_reserve(Buffer *b, size_t n) {
+    if (b->start + b->size + n <= b->capacity)
+        return;
+    if (b->start > 0) {
+        memmove(b->data, b->data + b->start, b->size);
+        b->start = 0;
+    }
+    if (b->size + n > b->capacity) {
+        while (b->size + n > b->capacity)
+            b->capacity = b->capacity ? 2 * b->capacity : READ_CHUNK;
+        b->data = realloc(b->data, b->capacity);
+        if (b->data == NULL)
+            fatal("Memory allocation failed");
+    }
+}
+
+static void buffer_append(Buffer *b, const void *data, size_t n) {
+    buffer_reserve(b, n);
+    memcpy(b->data + b->start + b->size, data, n);
+    b->size += n;
+}
+
+static void buffer_consume(Buffer *b, size_t n) {
+    b->start += n;
+    b->size -= n;
+    if (b->size == 0)
+        b->start = 0;
+}
+
+static void update_events(Server *s, Connection *c) {
+    struct epoll_event event = {0};
+    event.events = (c->paused || c->blocked || c->eof ? 0 : EPOLLIN) |
+                   (c->want_write ? EPOLLOUT : 0);
+    event.data.ptr = c;
+    if (epoll_ctl(s->epoll_fd, EPOLL_CTL_MOD, c->fd, &event) < 0)
+        syserr("Error in epoll_ctl");
+}
+
+// Zwalnia połączenie, jeśli jest zamknięte i nic się do niego już nie
+// odwołuje (także lista połączeń do opróżnienia).
+static void connection_release(Server *s, Connection *c) {
+    if (!c->closed || c->pending > 0 || c->dirty)
+        return;
+    if (c->prev)
+        c->prev->next = c->next;
+    else
+        s->connections = c->next;
+    if (c->next)
+        c->next->prev = c->prev;
+    free(c->in.data);
+    free(c->out.data);
+    free(c);
+}
+
+static void mark_dirty(Server *s, Connection *c) {
+    if (!c->dirty) {
+        c->dirty = true;
+        c->next_dirty = s->dirty;
+        s->dirty = c;
+    }
+}
+
+// Zamyka deskryptor połączenia. Samo połączenie zwalniamy dopiero na końcu
+// obrotu pętli (w flush_dirty), bo mogą się do niego odwoływać jeszcze
+// nieobsłużone zdarzenia z tego samego epoll_wait.
+static void connection_close(Server *s, Connection *c) {
+    if (c->closed)
+        return;
+    if (epoll_ctl(s->epoll_fd, EPOLL_CTL_DEL, c->fd, NULL) < 0)
+        syserr("Error in epoll_ctl");
+    close(c->fd);
+    c->closed = true;
+    mark_dirty(s, c);
+}
+
+static void backlog_push(Server *s, TreeRequest request) {
+    if (s->backlog_start + s->backlog_size == s->backlog_capacity) {
+        if (s->backlog_start > 0) {
+            memmove(s->backlog, s->backlog + s->backlog_start,
+                    s->backlog_size * sizeof(TreeRequest));
+            s->backlog_start = 0;
+        } else {
+            s->backlog_capacity = s->backlog_capacity
+                                  ? 2 * s->backlog_capacity : 256;
+            s->backlog = realloc(s->backlog, s->backlog_capacity *
+                                             sizeof(TreeRequest));
+            if (s->backlog == NULL)
+                fatal("Memory allocation failed");
+        }
+    }
+    s->backlog[s->backlog_start + s->backlog_size++] = request;
+}
+
+// Wyjmuje z bufora wejściowego wszystkie pełne ramki i dodaje ich żądania
+// do kolejki oczekujących. Zwraca fałsz, jeśli ramka jest błędna.
+static bool parse_requests(Server *s, Connection *c) {
+    PwtreedRequest header;
+    while (c->in.size >= sizeof(header)) {
+        memcpy(&header, c->in.data + c->in.start, sizeof(header));
+        if (header.type > PWTREED_LIST ||
+            header.path_length > MAX_PATH_LENGTH ||
+            header.target_length > MAX_PATH_LENGTH)
+            return false;
+        size_t length = sizeof(header) + header.path_length +
+                        header.target_length;
+        if (c->in.size < length)
+            break;
+        Call *call = malloc(sizeof(Call) + header.path_length +
+                            header.target_length + 2);
+        if (call == NULL)
+            fatal("Memory allocation failed");
+        call->conn = c;
+        call->id = header.id;
+        char *path = call->strings, *target = path + header.path_length + 1;
+        const char *frame = c->in.data + c->in.start + sizeof(header);
+        memcpy(path, frame, header.path_length);
+        path[header.path_length] = '\0';
+        memcpy(target, frame + header.path_length, header.target_length);
+        target[header.target_length] = '\0';
+        backlog_push(s, (TreeRequest) {header.type, path, target, call});
+        c->pending++;
+        buffer_consume(&c->in, length);
+    }
+    return true;
+}
+
+// Wysyła tyle odpowiedzi, ile się da, i czeka na EPOLLOUT, jeśli coś
+// zostało.
+static void connection_flush(Server *s, Connection *c) {
+    while (c->out.size > 0) {
+        ssize_t n = send(c->fd, c->out.data + c->out.start, c->out.size,
+                         MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        if (n < 0) {
+            connection_close(s, c);
+            return;
+        }
+        buffer_consume(&c->out, n);
+    }
+    bool want_write = c->out.size > 0;
+    if (c->eof && !want_write && c->pending == 0) {
+        connection_close(s, c);
+        return;
+    }
+    bool blocked = c->out.size > (c->blocked ? OUTPUT_LIMIT / 2 :
+                                  OUTPUT_LIMIT);
+    if (want_write != c->want_write || blocked != c->blocked) {
+        c->want_write = want_write;
+        c->blocked = blocked;
+        update_events(s, c);
+    }
+}
+
+static void connection_read(Server *s, Connection *c) {
+    while (!s->paused) {
+        buffer_reserve(&c->in, READ_CHUNK);
+        ssize_t n = read(c->fd, c->in.data + c->in.start + c->in.size,
+                         c->in.capacity - c->in.start - c->in.size);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        if (n < 0) {
+            connection_close(s, c);
+            return;
+        }
+        if (n == 0) {
+            c->eof = true;
+            update_events(s, c);
+            break;
+        }
+        c->in.size += n;
+        if (!parse_requests(s, c)) {
+            connection_close(s, c);
+            return;
+        }
+        if (s->backlog_size >= BACKLOG_LIMIT)
+            s->paused = true;
+    }
+    if (s->paused && !c->paused && !c->eof) {
+        c->paused = true;
+        update_events(s, c);
+    }
+    // Klient mógł zamknąć połączenie, nie czekając na odpowiedzi.
+    if (c->eof && c->pending == 0 && c->out.size == 0)
+        connection_close(s, c);
+}
+
+static void accept_connections(Server *s) {
+    while (true) {
+        int fd = accept4(s->listen_fd, NULL, NULL,
+                         SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0 && errno == EINTR)
+            continue;
+        if (fd < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return;
+        if (fd < 0) {
+            // Np. brak deskryptorów — spróbujemy przy następnym zdarzeniu.
+            perror("accept");
+            return;
+        }
+        Connection *c = calloc(1, sizeof(Connection));
+        if (c == NULL)
+            fatal("Memory allocation failed");
+        c->fd = fd;
+        c->paused = s->paused;
+        c->next = s->connections;
+        if (s->connections)
+            s->connections->prev = c;
+        s->connections = c;
+        struct epoll_event event = {0};
+        event.events = c->paused ? 0 : EPOLLIN;
+        event.data.ptr = c;
+        if (epoll_ctl(s->epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0)
+            syserr("Error in epoll_ctl");
+    }
+}
+
+// Odbiera wszystkie gotowe wyniki i dopisuje odpowiedzi do buforów
+// wyjściowych połączeń.
+static void reap_completions(Server *s) {
+    uint64_t count;
+    if (read(s->queue_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+        syserr("Error in read from eventfd");
+    TreeCompletion completions[REAP_BATCH];
+    size_t n;
+    while ((n = tree_queue_reap(s->queue, completions, REAP_BATCH)) > 0) {
+        s->in_flight -= n;
+        for (size_t i = 0; i < n; i++) {
+            Call *call = completions[i].user_data;
+            Connection *c = call->conn;
+            c->pending--;
+            if (!c->closed) {
+                const char *list = completions[i].list;
+                PwtreedResponse response = {
+                        call->id, completions[i].result,
+                        list ? (uint32_t) strlen(list) : 0};
+                buffer_append(&c->out, &response, sizeof(response));
+                if (list)
+                    buffer_append(&c->out, list, response.list_length);
+                mark_dirty(s, c);
+            } else {
+                connection_release(s, c);
+            }
+            free(completions[i].list);
+            free(call);
+        }
+    }
+}
+
+static void submit_backlog(Server *s) {
+    size_t n = tree_queue_submit(s->queue, s->backlog + s->backlog_start,
+                                 s->backlog_size);
+    s->in_flight += n;
+    s->backlog_start += n;
+    s->backlog_size -= n;
+    if (s->backlog_size == 0)
+        s->backlog_start = 0;
+    if (s->paused && s->backlog_size < BACKLOG_LIMIT / 2) {
+        s->paused = false;
+        for (Connection *c = s->connections; c; c = c->next) {
+            if (c->paused && !c->closed) {
+                c->paused = false;
+                update_events(s, c);
+            }
+        }
+    }
+}
+
+static void flush_dirty(Server *s) {
+    while (s->dirty) {
+        Connection *c = s->dirty;
+        s->dirty = c->next_dirty;
+        c->dirty = false;
+        if (c->closed)
+            connection_release(s, c);
+        else
+            connection_flush(s, c);
+    }
+}
+
+static void add_fd(Server *s, int fd, void *tag) {
+    struct epoll_event event = {0};
+    event.events = EPOLLIN;
+    event.data.ptr = tag;
+    if (epoll_ctl(s->epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0)
+        syserr("Error in epoll_ctl");
+}
+
+static void server_start(Server *s, const char *socket_path, size_t workers) {
+    struct sockaddr_un address = {0};
+    address.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(address.sun_path))
+        fatal("Socket path too long");
+    strcpy(address.sun_path, socket_path);
+    if ((s->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK |
+                                        SOCK_CLOEXEC, 0)) < 0)
+        syserr("Error in socket");
+    // Usuwamy tylko gniazdo, które zostało po poprzednim serwerze, a nie
+    // na przykład plik podany przez pomyłkę.
+    struct stat st;
+    if (lstat(socket_path, &st) == 0) {
+        if (!S_ISSOCK(st.st_mode))
+            fatal("%s exists and is not a socket", socket_path);
+        unlink(socket_path);
+    } else if (errno != ENOENT) {
+        syserr("Error in lstat");
+    }
+    if (bind(s->listen_fd, (struct sockaddr *) &address,
+             sizeof(address)) < 0)
+        syserr("Error in bind");
+    if (listen(s->listen_fd, SOMAXCONN) < 0)
+        syserr("Error in listen");
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    // Blokujemy sygnały przed utworzeniem wątków roboczych, żeby je
+    // odziedziczyły i żeby sygnały trafiały tylko do signalfd.
+    if ((errno = pthread_sigmask(SIG_BLOCK, &signals, NULL)) != 0)
+        syserr("Error in pthread_sigmask");
+    if ((s->signal_fd = signalfd(-1, &signals, SFD_NONBLOCK |
+                                               SFD_CLOEXEC)) < 0)
+        syserr("Error in signalfd");
+    s->tree = tree_new();
+    s->queue = tree_queue_new(s->tree, workers, QUEUE_CAPACITY);
+    s->queue_fd = tree_queue_fd(s->queue);
+    if ((s->epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+        syserr("Error in epoll_create1");
+    add_fd(s, s->listen_fd, &listen_tag);
+    add_fd(s, s->queue_fd, &queue_tag);
+    add_fd(s, s->signal_fd, &signal_tag);
+    s->backlog = NULL;
+    s->backlog_start = s->backlog_size = s->backlog_capacity = 0;
+    s->in_flight = 0;
+    s->paused = false;
+    s->connections = s->dirty = NULL;
+}
+
+static void server_run(Server *s) {
+    struct epoll_event events[MAX_EVENTS];
+    bool stop = false;
+    while (!stop) {
+        int n = epoll_wait(s->epoll_fd, events, MAX_EVENTS, -1);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            syserr("Error in epoll_wait");
+        for (int i = 0; i < n; i++) {
+            void *tag = events[i].data.ptr;
+            if (tag == &listen_tag) {
+                accept_connections(s);
+            } else if (tag == &queue_tag) {
+                reap_completions(s);
+            } else if (tag == &signal_tag) {
+                stop = true;
+            } else {
+                Connection *c = tag;
+                // Zdarzenia tego połączenia mogły dotyczyć już zamkniętego
+                // deskryptora, jeśli zamknęliśmy go wcześniej w tej pętli.
+                if (c->closed)
+                    continue;
+                // Po końcu danych HUP oznacza, że klient zamknął gniazdo
+                // całkiem, więc odpowiedzi i tak do niego nie dojdą.
+                if (c->eof && (events[i].events & (EPOLLHUP | EPOLLERR))) {
+                    connection_close(s, c);
+                    continue;
+                }
+                if (events[i].events & EPOLLOUT)
+                    connection_flush(s, c);
+                if (!c->closed &&
+                    (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+                    connection_read(s, c);
+            }
+        }
+        submit_backlog(s);
+        flush_dirty(s);
+    }
+}
+
+static void server_stop(Server *s, const char *socket_path) {
+    close(s->listen_fd);
+    unlink(socket_path);
+    // Nieprzyjęte żądania porzucamy, a na przyjęte czekamy, bo kolejka
+    // ma wskaźniki do ich ścieżek.
+    for (size_t i = 0; i < s->backlog_size; i++)
+        free(s->backlog[s->backlog_start + i].user_data);
+    while (s->in_flight > 0) {
+        TreeCompletion completions[REAP_BATCH];
+        size_t n = tree_queue_reap(s->queue, completions, REAP_BATCH);
+        s->in_flight -= n;
+        for (size_t i = 0; i < n; i++) {
+            free(completions[i].list);
+            free(completions[i].user_data);
+        }
+        if (n == 0)
+            usleep(1000);
+    }
+    tree_queue_free(s->queue);
+    tree_free(s->tree);
+    while (s->connections) {
+        Connection *c = s->connections;
+        s->connections = c->next;
+        if (!c->closed)
+            close(c->fd);
+        free(c->in.data);
+        free(c->out.data);
+        free(c);
+    }
+    free(s->backlog);
+    close(s->signal_fd);
+    close(s->epoll_fd);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2 || argc > 3) {
+        fprintf(stderr, "Usage: %s SOCKET_PATH [WORKERS]\n", argv[0]);
+        return 1;
+    }
+    long workers = argc == 3 ? strtol(argv[2], NULL, 10) : DEFAULT_WORKERS;
+    if (workers <= 0)
+        fatal("Number of workers must be positive");
+    Server server;
+    server_start(&server, argv[1], workers);
+    server_run(&server);
+    server_stop(&server, argv[1]);
+    return 0;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdint.h>
+
+// Protokół serwera pwtreed, który udostępnia jedno drzewo wielu procesom
+// przez gniazdo uniksowe (SOCK_STREAM). Klient wysyła ramki żądań, każda
+// to nagłówek PwtreedRequest, po którym następuje path_length bajtów ścieżki
+// i target_length bajtów ścieżki docelowej (bez kończących zer). Serwer
+// odpowiada na każde żądanie ramką PwtreedResponse, po której następuje
+// list_length bajtów wyniku tree_list (bez przecinków na końcu i bez zera).
+//
+// Klient może wysłać wiele żądań bez czekania na odpowiedzi. Odpowiedzi
+// mają ten sam id co żądanie i mogą przychodzić w innej kolejności,
+// a żądania wysłane bez czekania mogą się wykonać w dowolnej kolejności
+// (jak w tree_queue_submit) — żeby je uporządkować, trzeba poczekać na
+// odpowiedź na wcześniejsze. Liczby są w porządku bajtów hosta, bo gniazdo
+// jest lokalne. Błędna ramka powoduje zamknięcie połączenia.
+
+// Wartości pola type (takie same jak TreeOpType).
+enum {
+    PWTREED_CREATE,
+    PWTREED_REMOVE,
+    PWTREED_MOVE,
+    PWTREED_LIST
+};
+
+typedef struct PwtreedRequest {
+    uint32_t id;
+    uint8_t type;
+    uint8_t reserved;
+    // Długości ścieżek, co najwyżej MAX_PATH_LENGTH; target_length jest
+    // używane tylko dla PWTREED_MOVE (dla innych typów powinno być zerem)
+    uint16_t path_length;
+    uint16_t target_length;
+    uint16_t reserved2;
+} PwtreedRequest;
+
+typedef struct PwtreedResponse {
+    uint32_t id;
+    // Wynik operacji tak jak w TreeCompletion (dla PWTREED_LIST 0, jeśli
+    // folder istnieje, a ENOENT lub EINVAL wpp)
+    int32_t result;
+    uint32_t list_length;
+} PwtreedResponse;
@@ -0,0 +1,163 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../Tree.h"
+
+// Test tree_compact współbieżnie z operacjami na drzewie: listy folderów,
+// których nikt nie zmienia, są takie same przed, w trakcie i po
+// kompaktowaniu, zmieniane części drzewa kończą w oczekiwanym stanie,
+// a hashmapy z małą liczbą dzieci stają się tablicami.
+
+#define CHECK(condition)                                                     \
+    do {                                                                     \
+        if (!(condition)) {                                                  \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, \
+                    #condition);                                             \
+            exit(1);                                                         \
+        }                                                                    \
+    } while (0)
+
+#define WIDTH 5
+#define CHURNERS 2
+#define COMPACTIONS 30
+
+// Foldery niezmienianej części drzewa i ich listy sprzed kompaktowania.
+typedef struct Stable {
+    char **paths;
+    char **lists;
+    size_t n, capacity;
+} Stable;
+
+static int collect(const char *path, void *arg) {
+    Stable *s = arg;
+    if (s->n == s->capacity) {
+        s->capacity = s->capacity ? 2 * s->capacity : 64;
+        s->paths = realloc(s->paths, s->capacity * sizeof(char *));
+        s->lists = realloc(s->lists, s->capacity * sizeof(char *));
+        CHECK(s->paths != NULL && s->lists != NULL);
+    }
+    s->paths[s->n++] = strdup(path);
+    return 0;
+}
+
+static void build(Tree *tree, const char *root, int depth) {
+    char path[64];
+    for (int i = 0; i < WIDTH; i++) {
+        snprintf(path, sizeof(path), "%s%c/", root, 'a' + i);
+        CHECK(tree_create(tree, path) == 0);
+        if (depth > 1)
+            build(tree, path, depth - 1);
+    }
+}
+
+static void check_stable(Tree *tree, Stable *s) {
+    for (size_t i = 0; i < s->n; i++) {
+        char *list = tree_list(tree, s->paths[i]);
+        CHECK(list != NULL && strcmp(list, s->lists[i]) == 0);
+        free(list);
+    }
+}
+
+typedef struct Worker {
+    Tree *tree;
+    Stable *stable;
+    int id;
+    bool *stop;
+} Worker;
+
+// Tworzy i usuwa folder oraz przenosi folder tam i z powrotem w swojej
+// części drzewa, więc po każdym obrocie drzewo jest takie jak na początku.
+static void *churn(void *arg) {
+    Worker *w = arg;
+    char temporary[32], from[32], to[32];
+    snprintf(temporary, sizeof(temporary), "/c/%c/x/", 'a' + w->id);
+    snprintf(from, sizeof(from), "/c/%c/a/", 'a' + w->id);
+    snprintf(to, sizeof(to), "/c/%c/b/m/", 'a' + w->id);
+    while (!__atomic_load_n(w->stop, __ATOMIC_RELAXED)) {
+        CHECK(tree_create(w->tree, temporary) == 0);
+        CHECK(tree_move(w->tree, from, to) == 0);
+        CHECK(tree_remove(w->tree, temporary) == 0);
+        CHECK(tree_move(w->tree, to, from) == 0);
+    }
+    return NULL;
+}
+
+static void *read_stable(void *arg) {
+    Worker *w = arg;
+    while (!__atomic_load_n(w->stop, __ATOMIC_RELAXED))
+        check_stable(w->tree, w->stable);
+    return NULL;
+}
+
+static size_t children_bytes(Tree *tree) {
+    TreeMemoryUsage usage;
+    tree_memory_usage(tree, &usage);
+    return usage.children_bytes;
+}
+
+int main(void) {
+    Tree *tree = tree_new();
+    CHECK(tree_create(tree, "/s/") == 0);
+    build(tree, "/s/", 4);
+    CHECK(tree_create(tree, "/c/") == 0);
+    build(tree, "/c/", 2);
+    // Folder, w którym po usunięciach zostaje hashmapa z trzema dziećmi.
+    CHECK(tree_create(tree, "/m/") == 0);
+    char path[32];
+    for (int i = 0; i < 26; i++) {
+        snprintf(path, sizeof(path), "/m/%c/", 'a' + i);
+        CHECK(tree_create(tree, path) == 0);
+    }
+    for (int i = 3; i < 26; i++) {
+        snprintf(path, sizeof(path), "/m/%c/", 'a' + i);
+        CHECK(tree_remove(tree, path) == 0);
+    }
+    Stable stable = {NULL, NULL, 0, 0};
+    CHECK(tree_walk(tree, "/s/", collect, &stable, NULL) == 0);
+    for (size_t i = 0; i < stable.n; i++)
+        CHECK((stable.lists[i] = tree_list(tree, stable.paths[i])) != NULL);
+    char *before = tree_list(tree, "/");
+    size_t bytes = children_bytes(tree);
+
+    bool stop = false;
+    pthread_t threads[CHURNERS + 1];
+    Worker workers[CHURNERS + 1];
+    for (int i = 0; i <= CHURNERS; i++) {
+        workers[i] = (Worker) {tree, &stable, i, &stop};
+        CHECK(pthread_create(&threads[i], NULL, i < CHURNERS ? churn :
+                             read_stable, &workers[i]) == 0);
+    }
+    for (int i = 0; i < COMPACTIONS; i++) {
+        tree_compact(tree);
+        check_stable(tree, &stable);
+    }
+    __atomic_store_n(&stop, true, __ATOMIC_RELAXED);
+    for (int i = 0; i <= CHURNERS; i++)
+        CHECK(pthread_join(threads[i], NULL) == 0);
+
+    check_stable(tree, &stable);
+    char *after = tree_list(tree, "/");
+    CHECK(strcmp(before, after) == 0);
+    free(after);
+    free(before);
+    for (int i = 0; i < CHURNERS; i++) {
+        snprintf(path, sizeof(path), "/c/%c/", 'a' + i);
+        char *list = tree_list(tree, path);
+        CHECK(strcmp(list, "a,b,c,d,e") == 0);
+        free(list);
+    }
+    char *list = tree_list(tree, "/m/");
+    CHECK(strcmp(list, "a,b,c") == 0);
+    free(list);
+    // Hashmapa /m/ stała się tablicą.
+    CHECK(children_bytes(tree) < bytes);
+    for (size_t i = 0; i < stable.n; i++) {
+        free(stable.paths[i]);
+        free(stable.lists[i]);
+    }
+    free(stable.paths);
+    free(stable.lists);
+    tree_free(tree);
+    return 0;
+}
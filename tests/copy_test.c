@@ -0,0 +1,275 @@
+#include <errno.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../Tree.h"
+
+// Testy tree_copy: zawartości kopii małych (kopiowanych od razu) i dużych
+// (leniwych) poddrzew, kopii wewnątrz źródła, kopiowania współbieżnie
+// z pisarzami i zwalniania pamięci trzymanej przez leniwą kopię.
+
+#define CHECK(condition)                                                     \
+    do {                                                                     \
+        if (!(condition)) {                                                  \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, \
+                    #condition);                                             \
+            exit(1);                                                         \
+        }                                                                    \
+    } while (0)
+
+// Ścieżki folderów poddrzewa, względem jego korzenia.
+typedef struct Paths {
+    size_t prefix;
+    char **paths;
+    size_t n, capacity;
+} Paths;
+
+static int collect(const char *path, void *arg) {
+    Paths *p = arg;
+    if (p->n == p->capacity) {
+        p->capacity = p->capacity ? 2 * p->capacity : 64;
+        p->paths = realloc(p->paths, p->capacity * sizeof(char *));
+        CHECK(p->paths != NULL);
+    }
+    p->paths[p->n++] = strdup(path + p->prefix);
+    return 0;
+}
+
+static int compare_strings(const void *a, const void *b) {
+    return strcmp(*(char *const *) a, *(char *const *) b);
+}
+
+static Paths subtree(Tree *tree, const char *path) {
+    Paths p = {strlen(path), NULL, 0, 0};
+    CHECK(tree_walk(tree, path, collect, &p, NULL) == 0);
+    qsort(p.paths, p.n, sizeof(char *), compare_strings);
+    return p;
+}
+
+static bool same(Paths a, Paths b) {
+    if (a.n != b.n)
+        return false;
+    for (size_t i = 0; i < a.n; i++) {
+        if (strcmp(a.paths[i], b.paths[i]) != 0)
+            return false;
+    }
+    return true;
+}
+
+static void paths_free(Paths p) {
+    for (size_t i = 0; i < p.n; i++)
+        free(p.paths[i]);
+    free(p.paths);
+}
+
+static int count(const char *path, void *arg) {
+    (void) path;
+    (*(size_t *) arg)++;
+    return 0;
+}
+
+static size_t folders(Tree *tree, const char *path) {
+    size_t n = 0;
+    CHECK(tree_walk(tree, path, count, &n, NULL) == 0);
+    return n;
+}
+
+static size_t history_bytes(Tree *tree) {
+    TreeMemoryUsage usage;
+    tree_memory_usage(tree, &usage);
+    return usage.history_bytes;
+}
+
+// Tworzy pod `root` (który musi istnieć) drzewo o `width` dzieciach na
+// każdym z `depth` poziomów.
+static void build(Tree *tree, const char *root, int width, int depth) {
+    char path[64];
+    for (int i = 0; i < width; i++) {
+        snprintf(path, sizeof(path), "%s%c/", root, 'a' + i);
+        CHECK(tree_create(tree, path) == 0);
+        if (depth > 1)
+            build(tree, path, width, depth - 1);
+    }
+}
+
+static void test_contents(void) {
+    Tree *tree = tree_new();
+    CHECK(tree_create(tree, "/small/") == 0);
+    CHECK(tree_create(tree, "/big/") == 0);
+    build(tree, "/small/", 3, 2);
+    build(tree, "/big/", 8, 4);
+    const char *sources[] = {"/small/", "/big/"};
+    const char *targets[] = {"/smallcopy/", "/bigcopy/"};
+    const char *moved[] = {"/smallmoved/", "/bigmoved/"};
+    char path[64];
+    for (int i = 0; i < 2; i++) {
+        Paths before = subtree(tree, sources[i]);
+        CHECK(tree_copy(tree, sources[i], targets[i]) == 0);
+        CHECK(tree_copy(tree, sources[i], targets[i]) == EEXIST);
+        // Zmiany źródła po kopiowaniu nie są widoczne w kopii i na odwrót.
+        snprintf(path, sizeof(path), "%sb/new/", sources[i]);
+        CHECK(tree_create(tree, path) == 0);
+        snprintf(path, sizeof(path), "%sa/a/", sources[i]);
+        CHECK(tree_move(tree, path, moved[i]) == 0);
+        snprintf(path, sizeof(path), "%sc/added/", targets[i]);
+        CHECK(tree_create(tree, path) == 0);
+        Paths after = subtree(tree, sources[i]);
+        CHECK(!same(before, after));
+        paths_free(after);
+        CHECK(tree_remove(tree, path) == 0);
+        Paths copy = subtree(tree, targets[i]);
+        CHECK(same(before, copy));
+        paths_free(copy);
+        paths_free(before);
+    }
+    CHECK(tree_copy(tree, "/none/", "/x/") == ENOENT);
+    CHECK(tree_copy(tree, "/small/", "/none/x/") == ENOENT);
+    CHECK(tree_copy(tree, "/small/", "/") == EEXIST);
+    CHECK(tree_copy(tree, "/small", "/x/") == EINVAL);
+    // Wszystkie kopie są zmaterializowane, więc nie ma już historii.
+    CHECK(history_bytes(tree) == 0);
+    tree_free(tree);
+}
+
+static void test_inside_source(void) {
+    Tree *tree = tree_new();
+    CHECK(tree_create(tree, "/s/") == 0);
+    build(tree, "/s/", 6, 4);
+    for (int round = 0; round < 2; round++) {
+        // Kopia nie obejmuje samej siebie ani wcześniejszej kopii.
+        const char *target = round ? "/s/b/in/" : "/s/a/in/";
+        Paths before = subtree(tree, "/s/");
+        CHECK(tree_copy(tree, "/s/", target) == 0);
+        Paths copy = subtree(tree, target);
+        CHECK(same(before, copy));
+        CHECK(folders(tree, "/s/") == before.n + copy.n);
+        paths_free(copy);
+        paths_free(before);
+    }
+    char *list = tree_list(tree, "/s/b/in/a/");
+    CHECK(list != NULL && strcmp(list, "a,b,c,d,e,f,in") == 0);
+    free(list);
+    CHECK(history_bytes(tree) == 0);
+    tree_free(tree);
+}
+
+static bool listed(Tree *tree, const char *path, const char *name) {
+    char *list = tree_list(tree, path);
+    CHECK(list != NULL);
+    bool found = false;
+    for (char *token = strtok(list, ","); token; token = strtok(NULL, ","))
+        found |= strcmp(token, name) == 0;
+    free(list);
+    return found;
+}
+
+#define WRITERS 3
+#define COPIES 26
+
+typedef struct Writer {
+    Tree *tree;
+    int id;
+    bool *stop;
+} Writer;
+
+// Tworzy i usuwa folder w źródle i przenosi folder źródła tam i z powrotem
+// między dwoma miejscami w nim, więc każda kopia ma od n do n + 1 folderów
+// na pisarza.
+static void *writer(void *arg) {
+    Writer *w = arg;
+    char temporary[32], from[32], to[32];
+    snprintf(temporary, sizeof(temporary), "/s/%c/t%c/", 'a' + w->id,
+             'a' + w->id);
+    snprintf(from, sizeof(from), "/s/%c/a/", 'a' + w->id);
+    snprintf(to, sizeof(to), "/s/%c/m%c/", 'b' + w->id, 'a' + w->id);
+    while (!__atomic_load_n(w->stop, __ATOMIC_RELAXED)) {
+        CHECK(tree_create(w->tree, temporary) == 0);
+        CHECK(tree_remove(w->tree, temporary) == 0);
+        CHECK(tree_move(w->tree, from, to) == 0);
+        CHECK(tree_move(w->tree, to, from) == 0);
+    }
+    return NULL;
+}
+
+static void test_concurrent_writers(void) {
+    Tree *tree = tree_new();
+    CHECK(tree_create(tree, "/s/") == 0);
+    build(tree, "/s/", 6, 4);
+    size_t n = folders(tree, "/s/");
+    bool stop = false;
+    pthread_t threads[WRITERS];
+    Writer writers[WRITERS];
+    for (int i = 0; i < WRITERS; i++) {
+        writers[i] = (Writer) {tree, i, &stop};
+        CHECK(pthread_create(&threads[i], NULL, writer, &writers[i]) == 0);
+    }
+    char path[32], name[8];
+    for (int i = 0; i < COPIES; i++) {
+        snprintf(path, sizeof(path), "/c%c/", 'a' + i);
+        CHECK(tree_copy(tree, "/s/", path) == 0);
+        // Przeniesiony folder jest w kopii dokładnie raz.
+        size_t copied = folders(tree, path);
+        CHECK(copied >= n && copied <= n + WRITERS);
+        for (int w = 0; w < WRITERS; w++) {
+            snprintf(path, sizeof(path), "/c%c/%c/", 'a' + i, 'a' + w);
+            bool at_from = listed(tree, path, "a");
+            snprintf(path, sizeof(path), "/c%c/%c/", 'a' + i, 'b' + w);
+            snprintf(name, sizeof(name), "m%c", 'a' + w);
+            CHECK(at_from != listed(tree, path, name));
+        }
+    }
+    __atomic_store_n(&stop, true, __ATOMIC_RELAXED);
+    for (int i = 0; i < WRITERS; i++)
+        CHECK(pthread_join(threads[i], NULL) == 0);
+    CHECK(history_bytes(tree) == 0);
+    tree_free(tree);
+}
+
+#define CHURN 20000
+
+// Tworzy i usuwa CHURN razy folder i zwraca, o ile urosła przy tym sterta.
+static long churn(Tree *tree, const char *path) {
+    size_t start = mallinfo2().uordblks;
+    for (int i = 0; i < CHURN; i++) {
+        CHECK(tree_create(tree, path) == 0);
+        CHECK(tree_remove(tree, path) == 0);
+    }
+    return (long) mallinfo2().uordblks - (long) start;
+}
+
+static void test_memory_release(void) {
+    Tree *tree = tree_new();
+    CHECK(tree_create(tree, "/template/") == 0);
+    CHECK(tree_create(tree, "/template/a/") == 0);
+    CHECK(tree_create(tree, "/template/b/") == 0);
+    CHECK(tree_create(tree, "/big/") == 0);
+    build(tree, "/big/", 8, 4);
+    // Kopia małego szablonu jest od razu pełna i nie trzyma snapshotu.
+    CHECK(tree_copy(tree, "/template/", "/work/") == 0);
+    CHECK(history_bytes(tree) == 0);
+    // Pod sanitizerami mallinfo2 nic nie liczy (zwraca zera), więc wzrost
+    // sterty sprawdzamy tylko z malloc z glibc.
+    CHECK(churn(tree, "/work/x/") < 64 * 1024);
+    // Leniwa kopia trzyma snapshot, ale foldery stworzone po niej są
+    // zwalniane od razu po usunięciu.
+    CHECK(tree_copy(tree, "/big/", "/bigcopy/") == 0);
+    CHECK(churn(tree, "/work/x/") < 64 * 1024);
+    CHECK(churn(tree, "/bigcopy/a/x/") < 64 * 1024);
+    // Pierwsza zmiana starego folderu zamraża kopię jego dzieci.
+    CHECK(tree_create(tree, "/work/a/x/") == 0);
+    CHECK(history_bytes(tree) > 0);
+    // Przejście materializuje całą kopię, co kończy jej snapshot.
+    CHECK(folders(tree, "/bigcopy/") == folders(tree, "/big/"));
+    CHECK(history_bytes(tree) == 0);
+    tree_free(tree);
+}
+
+int main(void) {
+    test_contents();
+    test_inside_source();
+    test_concurrent_writers();
+    test_memory_release();
+    return 0;
+}
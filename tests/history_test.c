@@ -0,0 +1,178 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "../History.h"
+
+// Sprawdza liniowość losowych współbieżnych historii operacji na drzewie
+// i mierzy, ile przepustowości ustalonego scenariusza kosztuje zapisywanie
+// historii: porównuje wywołania przez history_run z bezpośrednimi
+// wywołaniami w tym samym uruchomieniu, więc wynik nie zależy od maszyny.
+// Użycie: history_test [liczba historii] [minimalny stosunek przepustowości
+// z zapisem do przepustowości bez niego]. Przy progu 0 (domyślnie) stosunek
+// jest tylko wypisywany.
+
+#define THREADS 4
+// Liczba operacji jednego wątku w historii — sprawdzanie jest wykładnicze
+// w liczbie operacji wykonywanych jednocześnie, więc historie są krótkie.
+#define HISTORY_OPS 40
+// Liczba operacji jednego wątku w scenariuszu mierzącym przepustowość
+// i liczba pomiarów każdego wariantu (bierzemy najlepszy)
+#define BENCH_OPS 20000
+#define BENCH_ROUNDS 3
+
+// Mało ścieżek, żeby operacje często dotyczyły tych samych folderów
+static const char *paths[] = {"/a/", "/b/", "/a/b/", "/b/a/", "/a/a/",
+                              "/b/b/", "/a/b/a/"};
+
+#define N_PATHS (sizeof(paths) / sizeof(paths[0]))
+
+typedef struct Recorder {
+    Tree *tree;
+    History *history;
+    unsigned seed;
+} Recorder;
+
+static void *record(void *data) {
+    Recorder *r = data;
+    for (int i = 0; i < HISTORY_OPS; i++) {
+        int kind = rand_r(&r->seed) % 10;
+        const char *path = paths[rand_r(&r->seed) % N_PATHS];
+        const char *target = paths[rand_r(&r->seed) % N_PATHS];
+        TreeOpType type = kind < 3 ? TREE_CREATE : kind < 5 ? TREE_REMOVE :
+                          kind < 7 ? TREE_MOVE : TREE_LIST;
+        history_run(r->history, r->tree, type, path, target);
+    }
+    return NULL;
+}
+
+// Zapisuje i sprawdza jedną historię. Ziarna wątków zależą tylko od numeru
+// historii, więc błąd da się powtórzyć (choć przeplot zależy od planisty).
+static bool check_round(int round) {
+    Tree *tree = tree_new();
+    History *history = history_new(THREADS * HISTORY_OPS);
+    pthread_t threads[THREADS];
+    Recorder recorders[THREADS];
+    for (int i = 0; i < THREADS; i++) {
+        recorders[i] = (Recorder) {tree, history, round * THREADS + i};
+        if (pthread_create(&threads[i], NULL, record, &recorders[i]) != 0) {
+            perror("pthread_create");
+            exit(1);
+        }
+    }
+    for (int i = 0; i < THREADS; i++)
+        pthread_join(threads[i], NULL);
+    bool linearizable = history_check(history);
+    if (!linearizable) {
+        fprintf(stderr, "history %d is not linearizable:\n", round);
+        history_dump(history, STDERR_FILENO);
+    }
+    history_free(history);
+    tree_free(tree);
+    return linearizable;
+}
+
+// Sprawdzarka musi odrzucić historię, w której drzewo zmieniono poza nią:
+// folder /b/ pojawia się w liście, choć nikt go nie stworzył.
+static bool check_rejects(void) {
+    Tree *tree = tree_new();
+    History *history = history_new(2);
+    history_run(history, tree, TREE_CREATE, "/a/", NULL);
+    tree_create(tree, "/b/");
+    history_run(history, tree, TREE_LIST, "/", NULL);
+    bool rejected = !history_check(history);
+    history_free(history);
+    tree_free(tree);
+    return rejected;
+}
+
+typedef struct Mover {
+    Tree *tree;
+    // Historia, w której zapisujemy operacje, albo NULL
+    History *history;
+    char from[8], to[8];
+} Mover;
+
+static int move_once(Mover *m, const char *from, const char *to) {
+    if (m->history)
+        return history_run(m->history, m->tree, TREE_MOVE, from, to);
+    return tree_move(m->tree, from, to);
+}
+
+// Wątek scenariusza mierzącego przepustowość: przenosi swój folder między
+// dwoma wspólnymi folderami, więc wątki konkurują o te same locki.
+static void *move(void *data) {
+    Mover *m = data;
+    for (int i = 0; i < BENCH_OPS / 2; i++) {
+        if (move_once(m, m->from, m->to) != 0 ||
+            move_once(m, m->to, m->from) != 0) {
+            fprintf(stderr, "tree_move %s failed\n", m->from);
+            exit(1);
+        }
+    }
+    return NULL;
+}
+
+// Mierzy przepustowość scenariusza z zapisem historii albo bez niego.
+static double ops_per_second(bool recorded) {
+    Tree *tree = tree_new();
+    History *history = recorded ? history_new(THREADS * BENCH_OPS) : NULL;
+    tree_create(tree, "/x/");
+    tree_create(tree, "/y/");
+    pthread_t threads[THREADS];
+    Mover movers[THREADS];
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < THREADS; i++) {
+        movers[i].tree = tree;
+        movers[i].history = history;
+        snprintf(movers[i].from, sizeof(movers[i].from), "/x/%c/", 'a' + i);
+        snprintf(movers[i].to, sizeof(movers[i].to), "/y/%c/", 'a' + i);
+        tree_create(tree, movers[i].from);
+        if (pthread_create(&threads[i], NULL, move, &movers[i]) != 0) {
+            perror("pthread_create");
+            exit(1);
+        }
+    }
+    for (int i = 0; i < THREADS; i++)
+        pthread_join(threads[i], NULL);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (history)
+        history_free(history);
+    tree_free(tree);
+    double elapsed = (end.tv_sec - start.tv_sec) +
+                     (end.tv_nsec - start.tv_nsec) / 1e9;
+    return THREADS * BENCH_OPS / elapsed;
+}
+
+int main(int argc, char *argv[]) {
+    int rounds = argc > 1 ? atoi(argv[1]) : 200;
+    double threshold = argc > 2 ? atof(argv[2]) : 0;
+    if (!check_rejects()) {
+        fprintf(stderr, "history checker accepted a wrong history\n");
+        return 1;
+    }
+    for (int round = 0; round < rounds; round++) {
+        if (!check_round(round))
+            return 1;
+    }
+    // Warianty mierzymy na przemian, żeby tak samo odczuły zmiany
+    // obciążenia maszyny.
+    double direct = 0, recorded = 0;
+    for (int i = 0; i < BENCH_ROUNDS; i++) {
+        double ops = ops_per_second(false);
+        direct = ops > direct ? ops : direct;
+        ops = ops_per_second(true);
+        recorded = ops > recorded ? ops : recorded;
+    }
+    double ratio = recorded / direct;
+    printf("%d histories linearizable, %.0f ops/s direct, %.0f ops/s "
+           "recorded (ratio %.2f, threshold %.2f)\n",
+           rounds, direct, recorded, ratio, threshold);
+    if (ratio < threshold) {
+        fprintf(stderr, "recording overhead above threshold\n");
+        return 1;
+    }
+    return 0;
+}
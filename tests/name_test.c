@@ -0,0 +1,163 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../Children.h"
+#include "../Name.h"
+
+// Testy spakowanych nazw: kodowania po 5 bitów na literę, porządku nazw
+// krótkich i długich (z puli), wyszukiwania bez referencji i zwalniania
+// wpisów puli przy współbieżnym kopiowaniu i oddawaniu referencji.
+
+#define CHECK(condition)                                                     \
+    do {                                                                     \
+        if (!(condition)) {                                                  \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, \
+                    #condition);                                             \
+            exit(1);                                                         \
+        }                                                                    \
+    } while (0)
+
+// Pamięć pustej puli (pula nie oddaje raz zaalokowanych kubełków).
+static size_t empty_pool;
+
+static int sign(int x) {
+    return (x > 0) - (x < 0);
+}
+
+// Losowa nazwa długości od 1 do max_length z liter od 'a' do 'a' + letters - 1
+// (mało liter daje dużo wspólnych prefiksów).
+static void random_name(char *buf, size_t max_length, int letters) {
+    size_t length = 1 + rand() % max_length;
+    for (size_t i = 0; i < length; i++)
+        buf[i] = (char) ('a' + rand() % letters);
+    buf[length] = '\0';
+}
+
+static void test_encoding(void) {
+    char str[64], back[64];
+    // Każda długość do granicy i trochę za nią, w tym litery z obu końców
+    // alfabetu na każdej pozycji słowa.
+    for (size_t length = 0; length <= NAME_INLINE_LENGTH + 4; length++) {
+        for (int first = 0; first < 26; first += 25) {
+            for (size_t i = 0; i < length; i++)
+                str[i] = (char) ('a' + (first + i) % 26);
+            str[length] = '\0';
+            Name name = name_new(str);
+            CHECK(((name.hi & NAME_INTERNED) != 0) ==
+                  (length > NAME_INLINE_LENGTH));
+            CHECK(name_length(name) == length);
+            CHECK(name_to_string(name, back) == length);
+            CHECK(strcmp(str, back) == 0);
+            Name again = name_new(str);
+            CHECK(name_equal(name, again));
+            CHECK(name_equal(name, name_lookup(str)));
+            CHECK(name_hash(name) == name_hash(name_lookup(str)));
+            name_release(again);
+            name_release(name);
+        }
+    }
+    // Krótkie nazwy mieszczą się w słowach bez puli.
+    Name z = name_new("zzzzzzzzzzzzzzzzzzzzzzzz");
+    CHECK(z.hi == z.lo);
+    CHECK((z.hi & (NAME_INTERNED | NAME_PROBE)) == 0);
+    CHECK(name_pool_memory() == empty_pool);
+}
+
+static void test_order(void) {
+    char a[64], b[64];
+    // Porządek ma się zgadzać z strcmp także między nazwami krótkimi
+    // i długimi, na przykład gdy jedna jest prefiksem drugiej.
+    for (int round = 0; round < 20000; round++) {
+        random_name(a, 2 * NAME_INLINE_LENGTH, 2);
+        if (round % 2)
+            random_name(b, 2 * NAME_INLINE_LENGTH, 2);
+        else
+            snprintf(b, sizeof(b), "%s%s", a, round % 4 ? "a" : "");
+        Name na = name_new(a), nb = name_new(b);
+        int expected = sign(strcmp(a, b));
+        CHECK(sign(name_compare(na, nb)) == expected);
+        CHECK(sign(name_compare(nb, na)) == -expected);
+        CHECK(sign(name_compare(name_lookup(a), nb)) == expected);
+        CHECK(sign(name_compare(na, name_lookup(b))) == expected);
+        CHECK(name_equal(na, nb) == (expected == 0));
+        CHECK(name_equal(name_lookup(a), nb) == (expected == 0));
+        name_release(nb);
+        name_release(na);
+    }
+    // Brzegowe przypadki wokół granicy długości.
+    Name inline_max = name_new("zzzzzzzzzzzzzzzzzzzzzzzz");
+    Name long_min = name_new("aaaaaaaaaaaaaaaaaaaaaaaaa");
+    Name inline_prefix = name_new("aaaaaaaaaaaaaaaaaaaaaaaa");
+    CHECK(name_compare(long_min, inline_max) < 0);
+    CHECK(name_compare(inline_prefix, long_min) < 0);
+    name_release(inline_prefix);
+    name_release(long_min);
+    name_release(inline_max);
+    CHECK(name_pool_memory() == empty_pool);
+}
+
+static void test_children_lookup(void) {
+    const char *long_name = "abcdefghijklmnopqrstuvwxyzabc";
+    Children children;
+    children_init(&children);
+    int values[CHILDREN_SMALL + 2];
+    char key[2] = "a";
+    // Wyszukiwanie długiej nazwy działa w każdej postaci zbioru.
+    for (int i = 0; i < CHILDREN_SMALL + 2; i++) {
+        CHECK(children_insert(&children, i ? key : long_name, &values[i]));
+        CHECK(children_get(&children, long_name) == &values[0]);
+        CHECK(children_get(&children, "abcdefghijklmnopqrstuvwxyzabd") ==
+              NULL);
+        key[0]++;
+    }
+    CHECK(children_rename(&children, long_name, "q"));
+    CHECK(children_get(&children, long_name) == NULL);
+    CHECK(name_pool_memory() == empty_pool);
+    CHECK(children_rename(&children, "q", long_name));
+    CHECK(children_remove(&children, long_name));
+    CHECK(!children_remove(&children, long_name));
+    CHECK(name_pool_memory() == empty_pool);
+    children_free(&children);
+}
+
+#define THREADS 4
+#define ROUNDS 20000
+
+static const char *shared = "thisisaverylongfoldernamethatisinterned";
+
+// Tworzy, kopiuje i oddaje wspólną nazwę, tak że ostatnia referencja jest
+// często oddawana współbieżnie z name_new i name_copy w innych wątkach.
+static void *churn(void *arg) {
+    (void) arg;
+    char buf[64];
+    for (int i = 0; i < ROUNDS; i++) {
+        Name own = name_new(shared);
+        Name copy = name_copy(own);
+        name_release(own);
+        CHECK(name_equal(copy, name_lookup(shared)));
+        CHECK(name_to_string(copy, buf) == strlen(shared));
+        name_release(copy);
+    }
+    return NULL;
+}
+
+static void test_concurrent_refs(void) {
+    pthread_t threads[THREADS];
+    for (int i = 0; i < THREADS; i++)
+        CHECK(pthread_create(&threads[i], NULL, churn, NULL) == 0);
+    for (int i = 0; i < THREADS; i++)
+        CHECK(pthread_join(threads[i], NULL) == 0);
+    CHECK(name_pool_memory() == empty_pool);
+}
+
+int main(void) {
+    srand(2137);
+    name_release(name_new("abcdefghijklmnopqrstuvwxyz"));
+    empty_pool = name_pool_memory();
+    test_encoding();
+    test_order();
+    test_children_lookup();
+    test_concurrent_refs();
+    return 0;
+}
@@ -0,0 +1,262 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "../pwtreed.h"
+
+// Test serwera pwtreed: uruchamia go na gnieździe w katalogu tymczasowym,
+// wysyła żądania po jednym i bez czekania na odpowiedzi, sprawdza
+// odpowiedzi, zamykanie połączenia po błędnej ramce, wstrzymywanie czytania
+// od klienta, który nie odbiera odpowiedzi, i to, że serwer nie usuwa
+// pliku, który nie jest gniazdem. Użycie: pwtreed_test ŚCIEŻKA_DO_PWTREED
+
+#define CHECK(condition)                                                     \
+    do {                                                                     \
+        if (!(condition)) {                                                  \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, \
+                    #condition);                                             \
+            exit(1);                                                         \
+        }                                                                    \
+    } while (0)
+
+static const char *daemon_path;
+static char socket_path[108];
+
+static pid_t start_daemon(const char *path) {
+    pid_t pid = fork();
+    CHECK(pid >= 0);
+    if (pid == 0) {
+        // Jeśli test się wywróci, serwer nie może go przeżyć.
+        prctl(PR_SET_PDEATHSIG, SIGKILL);
+        execl(daemon_path, daemon_path, path, "2", (char *) NULL);
+        _exit(127);
+    }
+    return pid;
+}
+
+static int connect_daemon(void) {
+    struct sockaddr_un address = {0};
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, socket_path);
+    // Serwer mógł jeszcze nie zacząć słuchać.
+    for (int attempt = 0; attempt < 500; attempt++) {
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        CHECK(fd >= 0);
+        if (connect(fd, (struct sockaddr *) &address, sizeof(address)) == 0)
+            return fd;
+        close(fd);
+        usleep(10000);
+    }
+    CHECK(false);
+    return -1;
+}
+
+static void write_all(int fd, const void *data, size_t size) {
+    while (size > 0) {
+        ssize_t n = write(fd, data, size);
+        CHECK(n > 0);
+        data = (const char *) data + n;
+        size -= n;
+    }
+}
+
+// Czyta dokładnie size bajtów; zwraca fałsz, jeśli serwer zamknął
+// połączenie przed pierwszym bajtem.
+static bool read_all(int fd, void *data, size_t size) {
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = read(fd, (char *) data + done, size - done);
+        if (n == 0 && done == 0)
+            return false;
+        CHECK(n > 0);
+        done += n;
+    }
+    return true;
+}
+
+static void send_request(int fd, uint32_t id, uint8_t type, const char *path,
+                         const char *target) {
+    PwtreedRequest request = {0};
+    request.id = id;
+    request.type = type;
+    request.path_length = strlen(path);
+    request.target_length = target ? strlen(target) : 0;
+    write_all(fd, &request, sizeof(request));
+    write_all(fd, path, request.path_length);
+    if (target)
+        write_all(fd, target, request.target_length);
+}
+
+// Odbiera odpowiedź; listę (z zerem na końcu) zapisuje do `list`.
+static PwtreedResponse receive(int fd, char *list, size_t list_size) {
+    PwtreedResponse response;
+    CHECK(read_all(fd, &response, sizeof(response)));
+    CHECK(response.list_length < list_size);
+    if (response.list_length > 0)
+        CHECK(read_all(fd, list, response.list_length));
+    list[response.list_length] = '\0';
+    return response;
+}
+
+// Wysyła żądanie, czeka na odpowiedź i sprawdza jej wynik oraz listę
+// (NULL — bez listy).
+static void call(int fd, uint8_t type, const char *path, const char *target,
+                 int32_t result, const char *list) {
+    static uint32_t next_id = 1;
+    uint32_t id = next_id++;
+    send_request(fd, id, type, path, target);
+    char buffer[256];
+    PwtreedResponse response = receive(fd, buffer, sizeof(buffer));
+    CHECK(response.id == id);
+    CHECK(response.result == result);
+    if (list)
+        CHECK(strcmp(buffer, list) == 0);
+    else
+        CHECK(response.list_length == 0);
+}
+
+static void test_sequential(int fd) {
+    call(fd, PWTREED_CREATE, "/a/", NULL, 0, NULL);
+    call(fd, PWTREED_CREATE, "/a/", NULL, EEXIST, NULL);
+    call(fd, PWTREED_CREATE, "/a/b/", NULL, 0, NULL);
+    call(fd, PWTREED_CREATE, "/x/y/", NULL, ENOENT, NULL);
+    call(fd, PWTREED_CREATE, "/A/", NULL, EINVAL, NULL);
+    call(fd, PWTREED_LIST, "/", NULL, 0, "a");
+    call(fd, PWTREED_MOVE, "/a/b/", "/c/", 0, NULL);
+    call(fd, PWTREED_LIST, "/a/", NULL, 0, "");
+    call(fd, PWTREED_LIST, "/x/", NULL, ENOENT, NULL);
+    call(fd, PWTREED_REMOVE, "/a/", NULL, 0, NULL);
+    call(fd, PWTREED_LIST, "/", NULL, 0, "c");
+}
+
+// Niezależne żądania wysłane bez czekania dostają po jednej odpowiedzi.
+static void test_pipelined(int fd) {
+    call(fd, PWTREED_CREATE, "/p/", NULL, 0, NULL);
+    char path[8];
+    for (int i = 0; i < 26; i++) {
+        snprintf(path, sizeof(path), "/p/%c/", 'a' + i);
+        send_request(fd, 1000 + i, PWTREED_CREATE, path, NULL);
+    }
+    bool seen[26] = {false};
+    char list[8];
+    for (int i = 0; i < 26; i++) {
+        PwtreedResponse response = receive(fd, list, sizeof(list));
+        CHECK(response.id >= 1000 && response.id < 1026);
+        CHECK(!seen[response.id - 1000]);
+        seen[response.id - 1000] = true;
+        CHECK(response.result == 0);
+    }
+    call(fd, PWTREED_LIST, "/p/", NULL, 0,
+         "a,b,c,d,e,f,g,h,i,j,k,l,m,n,o,p,q,r,s,t,u,v,w,x,y,z");
+}
+
+static void test_bad_frame(void) {
+    int fd = connect_daemon();
+    PwtreedRequest request = {0};
+    request.type = PWTREED_LIST + 1;
+    write_all(fd, &request, sizeof(request));
+    PwtreedResponse response;
+    CHECK(!read_all(fd, &response, sizeof(response)));
+    close(fd);
+}
+
+// Klient, który nie odbiera odpowiedzi, w końcu nie może wysyłać, bo
+// serwer przestaje od niego czytać; po odebraniu odpowiedzi wszystko
+// wraca do normy.
+static void test_backpressure(void) {
+    int fd = connect_daemon();
+    int flags = fcntl(fd, F_GETFL);
+    CHECK(fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0);
+    PwtreedRequest request = {0};
+    request.type = PWTREED_LIST;
+    request.path_length = strlen("/p/");
+    char frame[sizeof(request) + 3];
+    memcpy(frame, &request, sizeof(request));
+    memcpy(frame + sizeof(request), "/p/", 3);
+    size_t sent = 0;
+    bool blocked = false;
+    // Odpowiedzi są kilka razy większe od żądań, więc bez wstrzymywania
+    // tyle żądań nigdy nie zapełni gniazda.
+    while (sent < 200000 && !blocked) {
+        ssize_t n = send(fd, frame, sizeof(frame), MSG_NOSIGNAL);
+        if (n < 0) {
+            CHECK(errno == EAGAIN || errno == EWOULDBLOCK);
+            struct pollfd p = {fd, POLLOUT, 0};
+            blocked = poll(&p, 1, 2000) == 0;
+            continue;
+        }
+        // Gniazdo uniksowe SOCK_STREAM przyjmuje małą ramkę w całości.
+        CHECK(n == sizeof(frame));
+        sent++;
+    }
+    CHECK(blocked);
+    CHECK(fcntl(fd, F_SETFL, flags) == 0);
+    char list[64];
+    for (size_t i = 0; i < sent; i++) {
+        PwtreedResponse response = receive(fd, list, sizeof(list));
+        CHECK(response.result == 0 && response.list_length == 51);
+    }
+    call(fd, PWTREED_LIST, "/", NULL, 0, "c,p");
+    close(fd);
+}
+
+// Serwer ma odmówić startu na ścieżce zwykłego pliku i go nie usuwać.
+static void test_not_a_socket(const char *path) {
+    int file = open(path, O_CREAT | O_WRONLY | O_CLOEXEC, 0600);
+    CHECK(file >= 0);
+    close(file);
+    int status;
+    CHECK(waitpid(start_daemon(path), &status, 0) > 0);
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) != 0);
+    struct stat st;
+    CHECK(lstat(path, &st) == 0 && S_ISREG(st.st_mode));
+    CHECK(unlink(path) == 0);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s PWTREED_PATH\n", argv[0]);
+        return 1;
+    }
+    daemon_path = argv[1];
+    char directory[] = "/tmp/pwtreed-test-XXXXXX";
+    CHECK(mkdtemp(directory) != NULL);
+    char file_path[64];
+    snprintf(file_path, sizeof(file_path), "%s/file", directory);
+    snprintf(socket_path, sizeof(socket_path), "%s/socket", directory);
+    test_not_a_socket(file_path);
+    // Gniazdo, które zostało po poprzednim serwerze, jest zastępowane.
+    int stale = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    struct sockaddr_un address = {0};
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, socket_path);
+    CHECK(bind(stale, (struct sockaddr *) &address, sizeof(address)) == 0);
+    close(stale);
+    pid_t pid = start_daemon(socket_path);
+    int fd = connect_daemon();
+    test_sequential(fd);
+    test_pipelined(fd);
+    test_bad_frame();
+    test_backpressure();
+    // Pierwsze połączenie nadal działa.
+    call(fd, PWTREED_LIST, "/c/", NULL, 0, "");
+    close(fd);
+    CHECK(kill(pid, SIGTERM) == 0);
+    int status;
+    CHECK(waitpid(pid, &status, 0) == pid);
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    struct stat st;
+    CHECK(lstat(socket_path, &st) < 0 && errno == ENOENT);
+    CHECK(rmdir(directory) == 0);
+    return 0;
+}
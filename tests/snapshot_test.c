@@ -0,0 +1,199 @@
+#include <errno.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../Tree.h"
+
+// Testy snapshotów: spójności odczytów przy współbieżnych pisarzach, braku
+// zamrażania kopii dzieci wierzchołków nowszych niż wszystkie snapshoty
+// ani przy nieudanych przeniesieniach i zwalniania usuniętych wierzchołków
+// przy końcu snapshotu.
+
+#define CHECK(condition)                                                     \
+    do {                                                                     \
+        if (!(condition)) {                                                  \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, \
+                    #condition);                                             \
+            exit(1);                                                         \
+        }                                                                    \
+    } while (0)
+
+static bool stop;
+
+// Przenosi /x/f/ do /y/f/ i z powrotem.
+static void *mover(void *arg) {
+    Tree *tree = arg;
+    while (!__atomic_load_n(&stop, __ATOMIC_RELAXED)) {
+        CHECK(tree_move(tree, "/x/f/", "/y/f/") == 0);
+        CHECK(tree_move(tree, "/y/f/", "/x/f/") == 0);
+    }
+    return NULL;
+}
+
+// Tworzy i usuwa w jednej transakcji /p/a/ i /q/a/, a poza transakcjami
+// tworzy i usuwa dzieci /p/ (żeby snapshoty miały co zamrażać).
+static void *pairs(void *arg) {
+    Tree *tree = arg;
+    while (!__atomic_load_n(&stop, __ATOMIC_RELAXED)) {
+        for (int remove = 0; remove < 2; remove++) {
+            TreeTxn *txn = tree_txn_begin(tree);
+            TreeOpType type = remove ? TREE_REMOVE : TREE_CREATE;
+            CHECK(tree_txn_add(txn, type, "/p/a/", NULL) == 0);
+            CHECK(tree_txn_add(txn, type, "/q/a/", NULL) == 0);
+            CHECK(tree_txn_commit(txn, NULL) == 0);
+        }
+        CHECK(tree_create(tree, "/p/b/") == 0);
+        CHECK(tree_remove(tree, "/p/b/") == 0);
+    }
+    return NULL;
+}
+
+static bool listed(TreeSnapshot *snapshot, const char *path,
+                   const char *name) {
+    char *list = tree_snapshot_list(snapshot, path);
+    CHECK(list != NULL);
+    bool found = false;
+    for (char *token = strtok(list, ","); token; token = strtok(NULL, ","))
+        found |= strcmp(token, name) == 0;
+    free(list);
+    return found;
+}
+
+static void test_consistency(void) {
+    Tree *tree = tree_new();
+    const char *folders[] = {"/x/", "/y/", "/x/f/", "/p/", "/q/"};
+    for (size_t i = 0; i < sizeof(folders) / sizeof(folders[0]); i++)
+        CHECK(tree_create(tree, folders[i]) == 0);
+    pthread_t threads[2];
+    CHECK(pthread_create(&threads[0], NULL, mover, tree) == 0);
+    CHECK(pthread_create(&threads[1], NULL, pairs, tree) == 0);
+    for (int i = 0; i < 3000; i++) {
+        TreeSnapshot *snapshot = tree_snapshot_begin(tree);
+        // Przeniesienie i transakcja są albo całe w snapshocie, albo wcale.
+        bool in_x = listed(snapshot, "/x/", "f");
+        CHECK(in_x != listed(snapshot, "/y/", "f"));
+        bool in_p = listed(snapshot, "/p/", "a");
+        CHECK(in_p == listed(snapshot, "/q/", "a"));
+        // Kolejne odczyty z tego samego snapshotu widzą to samo.
+        sched_yield();
+        CHECK(listed(snapshot, "/x/", "f") == in_x);
+        CHECK(listed(snapshot, "/p/", "a") == in_p);
+        char *list = tree_snapshot_list(snapshot, "/x/f/");
+        CHECK((list != NULL) == in_x);
+        free(list);
+        tree_snapshot_end(snapshot);
+    }
+    __atomic_store_n(&stop, true, __ATOMIC_RELAXED);
+    for (int i = 0; i < 2; i++)
+        CHECK(pthread_join(threads[i], NULL) == 0);
+    TreeMemoryUsage usage;
+    tree_memory_usage(tree, &usage);
+    CHECK(usage.history_bytes == 0);
+    tree_free(tree);
+}
+
+static size_t history_bytes(Tree *tree) {
+    TreeMemoryUsage usage;
+    tree_memory_usage(tree, &usage);
+    return usage.history_bytes;
+}
+
+static void test_new_nodes(void) {
+    Tree *tree = tree_new();
+    CHECK(tree_create(tree, "/old/") == 0);
+    TreeSnapshot *snapshot = tree_snapshot_begin(tree);
+    // Zmiana wierzchołka, który widzi snapshot, zamraża kopię jego dzieci.
+    size_t before = history_bytes(tree);
+    CHECK(tree_create(tree, "/old/a/") == 0);
+    size_t after_old = history_bytes(tree);
+    CHECK(after_old > before);
+    // Zmiany wierzchołków stworzonych po snapshocie nie zamrażają kopii,
+    // więc przybywa tylko stempli nowych wierzchołków: /old/a/b/ ...
+    CHECK(tree_create(tree, "/old/a/b/") == 0);
+    size_t stamp = history_bytes(tree) - after_old;
+    // ... i /old/a/b/d/ (/old/a/b/c/ jest już usunięte z drzewa).
+    CHECK(tree_create(tree, "/old/a/b/c/") == 0);
+    CHECK(tree_create(tree, "/old/a/b/d/") == 0);
+    CHECK(tree_remove(tree, "/old/a/b/c/") == 0);
+    CHECK(history_bytes(tree) == after_old + 2 * stamp);
+    char *list = tree_snapshot_list(snapshot, "/old/");
+    CHECK(list != NULL && strcmp(list, "") == 0);
+    free(list);
+    tree_snapshot_end(snapshot);
+    CHECK(history_bytes(tree) == 0);
+    tree_free(tree);
+}
+
+static void test_failed_rename(void) {
+    Tree *tree = tree_new();
+    CHECK(tree_create(tree, "/d/") == 0);
+    CHECK(tree_create(tree, "/d/a/") == 0);
+    CHECK(tree_create(tree, "/d/b/") == 0);
+    TreeSnapshot *snapshot = tree_snapshot_begin(tree);
+    // Nieudane przeniesienie w obrębie folderu niczego nie zamraża.
+    CHECK(tree_move(tree, "/d/a/", "/d/b/") == EEXIST);
+    CHECK(tree_move(tree, "/d/x/", "/d/y/") == ENOENT);
+    CHECK(tree_move(tree, "/d/a/", "/d/a/") == 0);
+    CHECK(history_bytes(tree) == 0);
+    CHECK(tree_move(tree, "/d/a/", "/d/c/") == 0);
+    CHECK(history_bytes(tree) > 0);
+    char *list = tree_snapshot_list(snapshot, "/d/");
+    CHECK(list != NULL && strcmp(list, "a,b") == 0);
+    free(list);
+    tree_snapshot_end(snapshot);
+    CHECK(history_bytes(tree) == 0);
+    tree_free(tree);
+}
+
+#define RETIRED 5000
+
+static void retired_path(char *path, size_t size, int i) {
+    snprintf(path, size, "/r/%c%c%c/", 'a' + i % 26, 'a' + i / 26 % 26,
+             'a' + i / 676);
+}
+
+static void test_retired_freed(void) {
+    Tree *tree = tree_new();
+    char path[16];
+    CHECK(tree_create(tree, "/r/") == 0);
+    for (int i = 0; i < RETIRED; i++) {
+        retired_path(path, sizeof(path), i);
+        CHECK(tree_create(tree, path) == 0);
+    }
+    TreeSnapshot *snapshot = tree_snapshot_begin(tree);
+    for (int i = 0; i < RETIRED; i++) {
+        retired_path(path, sizeof(path), i);
+        CHECK(tree_remove(tree, path) == 0);
+    }
+    // Usunięte wierzchołki widzi jeszcze snapshot, więc czekają na jego
+    // koniec.
+    char *list = tree_snapshot_list(snapshot, "/r/");
+    CHECK(list != NULL);
+    size_t listed_count = 1;
+    for (char *c = list; *c; c++)
+        listed_count += *c == ',';
+    CHECK(listed_count == RETIRED);
+    free(list);
+    retired_path(path, sizeof(path), RETIRED - 1);
+    list = tree_snapshot_list(snapshot, path);
+    CHECK(list != NULL && strcmp(list, "") == 0);
+    free(list);
+    size_t held = mallinfo2().uordblks;
+    tree_snapshot_end(snapshot);
+    size_t released = mallinfo2().uordblks;
+    // Pod sanitizerami mallinfo2 nic nie liczy (zwraca zera).
+    CHECK(held == 0 || released + RETIRED * 256 < held);
+    CHECK(history_bytes(tree) == 0);
+    tree_free(tree);
+}
+
+int main(void) {
+    test_consistency();
+    test_new_nodes();
+    test_failed_rename();
+    test_retired_freed();
+    return 0;
+}
@@ -0,0 +1,125 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../Tree.h"
+
+// Testy indeksu pierwszej nieudanej operacji transakcji, także wtedy, gdy
+// brakuje rodzica potrzebnego operacji, która nie jest pierwszą nieudaną.
+
+#define CHECK(condition)                                                     \
+    do {                                                                     \
+        if (!(condition)) {                                                  \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, \
+                    #condition);                                             \
+            exit(1);                                                         \
+        }                                                                    \
+    } while (0)
+
+// Operacja transakcji w zapisie tekstowym: 'c' — tworzenie, 'r' — usunięcie,
+// 'm' — przeniesienie z path do target.
+typedef struct Op {
+    char type;
+    const char *path, *target;
+} Op;
+
+static int commit(Tree *tree, const Op *ops, size_t n, size_t *failed) {
+    TreeTxn *txn = tree_txn_begin(tree);
+    for (size_t i = 0; i < n; i++) {
+        TreeOpType type = ops[i].type == 'c' ? TREE_CREATE :
+                          ops[i].type == 'r' ? TREE_REMOVE : TREE_MOVE;
+        CHECK(tree_txn_add(txn, type, ops[i].path, ops[i].target) == 0);
+    }
+    *failed = n + 1;
+    return tree_txn_commit(txn, failed);
+}
+
+static void check_list(Tree *tree, const char *path, const char *expected) {
+    char *list = tree_list(tree, path);
+    CHECK(list != NULL);
+    if (strcmp(list, expected) != 0) {
+        fprintf(stderr, "tree_list(%s): \"%s\", expected \"%s\"\n", path,
+                list, expected);
+        exit(1);
+    }
+    free(list);
+}
+
+static void test_first_failure(void) {
+    Tree *tree = tree_new();
+    CHECK(tree_create(tree, "/b/") == 0);
+    size_t failed;
+
+    // Brakuje /nope/, ale wcześniej nie powiedzie się usunięcie /b/zzz/.
+    Op remove_first[] = {{'r', "/b/zzz/", NULL}, {'c', "/nope/q/", NULL}};
+    CHECK(commit(tree, remove_first, 2, &failed) == ENOENT);
+    CHECK(failed == 0);
+
+    // Pierwsza nieudana operacja zwraca inny błąd niż ENOENT.
+    Op exists_first[] = {{'c', "/b/", NULL}, {'c', "/nope/q/", NULL}};
+    CHECK(commit(tree, exists_first, 2, &failed) == EEXIST);
+    CHECK(failed == 0);
+
+    // Pierwsza nieudana jest ta, której brakuje rodzica, a wcześniejsze
+    // operacje zostają wycofane.
+    Op create_first[] = {{'c', "/a/", NULL}, {'m', "/b/", "/a/b/"},
+                         {'c', "/nope/q/", NULL}, {'r', "/b/zzz/", NULL}};
+    CHECK(commit(tree, create_first, 4, &failed) == ENOENT);
+    CHECK(failed == 2);
+    check_list(tree, "/", "b");
+
+    // Brakujący rodzic przeniesienia i dwa różne brakujące poddrzewa
+    Op move_target[] = {{'c', "/a/", NULL}, {'c', "/x/y/z/", NULL},
+                        {'m', "/b/", "/nope/b/"}};
+    CHECK(commit(tree, move_target, 3, &failed) == ENOENT);
+    CHECK(failed == 1);
+    check_list(tree, "/", "b");
+
+    // Rodzic stworzony przez wcześniejszą operację tej samej transakcji
+    Op created[] = {{'c', "/n/", NULL}, {'c', "/n/q/", NULL}};
+    CHECK(commit(tree, created, 2, &failed) == 0);
+    // Po sukcesie `*failed` zostaje bez zmian
+    CHECK(failed == 3);
+    check_list(tree, "/n/", "q");
+    tree_free(tree);
+}
+
+// Wątek, który na przemian tworzy i usuwa /nope/, więc brakujący rodzic
+// może się pojawić między kolejnymi próbami zdobycia locków.
+static void *flip(void *data) {
+    Tree *tree = data;
+    for (int i = 0; i < 20000; i++) {
+        tree_create(tree, "/nope/");
+        tree_remove(tree, "/nope/q/");
+        tree_remove(tree, "/nope/");
+    }
+    return NULL;
+}
+
+static void test_concurrent(void) {
+    Tree *tree = tree_new();
+    CHECK(tree_create(tree, "/b/") == 0);
+    pthread_t thread;
+    CHECK(pthread_create(&thread, NULL, flip, tree) == 0);
+    for (int i = 0; i < 20000; i++) {
+        size_t failed;
+        Op ops[] = {{'r', "/b/zzz/", NULL}, {'c', "/nope/q/", NULL}};
+        CHECK(commit(tree, ops, 2, &failed) == ENOENT);
+        CHECK(failed == 0);
+        Op later[] = {{'c', "/b/c/", NULL}, {'c', "/nope/q/", NULL},
+                      {'r', "/b/c/", NULL}};
+        int result = commit(tree, later, 3, &failed);
+        CHECK(result == 0 ? failed == 4 :
+              (result == ENOENT || result == EEXIST) && failed == 1);
+        check_list(tree, "/b/", "");
+    }
+    CHECK(pthread_join(thread, NULL) == 0);
+    tree_free(tree);
+}
+
+int main(void) {
+    test_first_failure();
+    test_concurrent();
+    return 0;
+}
@@ -0,0 +1,150 @@
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "../Tree.h"
+
+// Test przechodzenia poddrzewa współbieżnie z przeniesieniami, które biorą
+// writelocki zarówno wewnątrz przechodzonego poddrzewa, jak i poza nim.
+// Zakleszczenie kończy test przez alarm.
+
+#define CHECK(condition)                                                     \
+    do {                                                                     \
+        if (!(condition)) {                                                  \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, \
+                    #condition);                                             \
+            exit(1);                                                         \
+        }                                                                    \
+    } while (0)
+
+#define ROUNDS 300
+#define TIMEOUT 120
+
+// Pary ścieżek, między którymi przenosimy foldery tam i z powrotem. Poza
+// tym dla każdej pary folderów p < q z SIBLINGS przenosimy /c/p/s/kq/ do
+// /c/q/kp/: przenoszący trzyma wtedy writelock na /c/p/s/ i czeka na /c/q/,
+// więc przechodzenie, które trzyma już /c/q/, nie może czekać na /c/p/s/.
+static const char *moves[][2] = {
+        {"/c/x/s/", "/d/s/"},
+        {"/c/b/", "/d/b/"},
+};
+
+#define N_MOVES (sizeof(moves) / sizeof(moves[0]))
+#define SIBLINGS "afkpuz"
+#define N_SIBLINGS (sizeof(SIBLINGS) - 1)
+#define N_MOVERS (N_MOVES + N_SIBLINGS * (N_SIBLINGS - 1) / 2)
+
+typedef struct Mover {
+    Tree *tree;
+    char from[16], to[16];
+    volatile bool *stop;
+} Mover;
+
+static void *mover(void *data) {
+    Mover *m = data;
+    while (!__atomic_load_n(m->stop, __ATOMIC_RELAXED)) {
+        // Przeniesienia innych wątków mogą zabrać folder (np. /c/x/s/
+        // razem z /c/x/), więc błędy są tu w porządku.
+        tree_move(m->tree, m->from, m->to);
+        tree_move(m->tree, m->to, m->from);
+    }
+    return NULL;
+}
+
+typedef struct Count {
+    size_t visited;
+    size_t limit;
+} Count;
+
+static int count(const char *path, void *arg) {
+    Count *c = arg;
+    CHECK(strncmp(path, "/c/", 3) == 0);
+    size_t visited = __atomic_add_fetch(&c->visited, 1, __ATOMIC_RELAXED);
+    // Dajemy przenoszącym szansę wejść między odwiedzenie folderu i jego
+    // dzieci, także na jednym procesorze.
+    sched_yield();
+    return c->limit > 0 && visited >= c->limit;
+}
+
+static void build(Tree *tree) {
+    const char *folders[] = {"/c/", "/d/", "/c/x/", "/c/x/s/", "/c/b/"};
+    for (size_t i = 0; i < sizeof(folders) / sizeof(folders[0]); i++)
+        CHECK(tree_create(tree, folders[i]) == 0);
+    // Foldery z SIBLINGS i trochę więcej, żeby przechodzenie trwało i było
+    // co kraść
+    char path[32];
+    for (const char *p = SIBLINGS; *p; p++) {
+        snprintf(path, sizeof(path), "/c/%c/", *p);
+        CHECK(tree_create(tree, path) == 0);
+        snprintf(path, sizeof(path), "/c/%c/s/", *p);
+        CHECK(tree_create(tree, path) == 0);
+        for (const char *q = p + 1; *q; q++) {
+            snprintf(path, sizeof(path), "/c/%c/s/k%c/", *p, *q);
+            CHECK(tree_create(tree, path) == 0);
+        }
+        for (char q = 'a'; q <= 'z'; q++) {
+            snprintf(path, sizeof(path), "/c/%c/%c%c/", *p, q, q);
+            CHECK(tree_create(tree, path) == 0);
+            snprintf(path, sizeof(path), "/c/x/s/%c%c/", *p, q);
+            CHECK(tree_create(tree, path) == 0);
+        }
+    }
+}
+
+// Liczba wątków procesu.
+static int threads_alive(void) {
+    FILE *status = fopen("/proc/self/status", "r");
+    CHECK(status != NULL);
+    char line[256];
+    int threads = -1;
+    while (fgets(line, sizeof(line), status))
+        sscanf(line, "Threads: %d", &threads);
+    fclose(status);
+    return threads;
+}
+
+int main(void) {
+    alarm(TIMEOUT);
+    Tree *tree = tree_new();
+    build(tree);
+    volatile bool stop = false;
+    pthread_t threads[N_MOVERS];
+    Mover movers[N_MOVERS];
+    size_t n = 0;
+    for (size_t i = 0; i < N_MOVES; i++, n++) {
+        movers[n] = (Mover) {tree, "", "", &stop};
+        strcpy(movers[n].from, moves[i][0]);
+        strcpy(movers[n].to, moves[i][1]);
+    }
+    for (size_t i = 0; i < N_SIBLINGS; i++) {
+        for (size_t j = i + 1; j < N_SIBLINGS; j++, n++) {
+            movers[n] = (Mover) {tree, "", "", &stop};
+            snprintf(movers[n].from, sizeof(movers[n].from), "/c/%c/s/k%c/",
+                     SIBLINGS[i], SIBLINGS[j]);
+            snprintf(movers[n].to, sizeof(movers[n].to), "/c/%c/k%c/",
+                     SIBLINGS[j], SIBLINGS[i]);
+        }
+    }
+    for (size_t i = 0; i < N_MOVERS; i++)
+        CHECK(pthread_create(&threads[i], NULL, mover, &movers[i]) == 0);
+    int alive = threads_alive() - (int) N_MOVERS;
+    for (int round = 0; round < ROUNDS; round++) {
+        // Na zmianę jeden wątek, kilka wątków i przechodzenie przerwane
+        // przez visitor, które kończy zadania bez zdobywania readlocków.
+        TreeWalkOptions opts = {round % 2 ? 4 : 1, round % 4 == 3};
+        Count c = {0, round % 3 == 2 ? 10 : 0};
+        int result = tree_walk(tree, "/c/", count, &c, &opts);
+        CHECK(result == (c.limit > 0 ? 1 : 0));
+        CHECK(c.visited > 0);
+    }
+    __atomic_store_n(&stop, true, __ATOMIC_RELAXED);
+    for (size_t i = 0; i < N_MOVERS; i++)
+        CHECK(pthread_join(threads[i], NULL) == 0);
+    // Przejścia po 4 wątki używały ciągle tych samych 3 wątków z puli.
+    CHECK(threads_alive() == alive + 3);
+    tree_free(tree);
+    return 0;
+}
@@ -0,0 +1,225 @@
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../Watch.h"
+
+// Testy obserwacji: kolejności zdarzeń i par cookie przy przeniesieniach,
+// dopasowywania obserwacji rekurencyjnych i nierekurencyjnych, zgłaszania
+// przepełnienia bufora, bufora z wieloma piszącymi naraz i tego, że
+// zdarzenia w nieobserwowanych częściach drzewa omijają lock rejestru.
+
+#define CHECK(condition)                                                     \
+    do {                                                                     \
+        if (!(condition)) {                                                  \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, \
+                    #condition);                                             \
+            exit(1);                                                         \
+        }                                                                    \
+    } while (0)
+
+typedef struct Expected {
+    TreeEventType type;
+    const char *path;
+} Expected;
+
+// Odbiera wszystkie gotowe zdarzenia i sprawdza, że są dokładnie takie jak
+// `expected`; ich cookie zapisuje do `cookies`.
+static void expect(TreeWatch *watch, const Expected *expected, size_t n,
+                   uint64_t *cookies) {
+    TreeEvent events[16];
+    CHECK(n < 16);
+    CHECK(tree_watch_read(watch, events, 16, false) == n);
+    for (size_t i = 0; i < n; i++) {
+        CHECK(events[i].type == expected[i].type);
+        CHECK(strcmp(events[i].path, expected[i].path) == 0);
+        cookies[i] = events[i].cookie;
+        free(events[i].path);
+    }
+}
+
+static bool ready(TreeWatch *watch) {
+    struct pollfd pfd = {tree_watch_fd(watch), POLLIN, 0};
+    CHECK(poll(&pfd, 1, 0) >= 0);
+    return pfd.revents & POLLIN;
+}
+
+static void test_sequence(void) {
+    Tree *tree = tree_new();
+    CHECK(tree_create(tree, "/a/") == 0);
+    CHECK(tree_watch(tree, "/a", false) == NULL);
+    TreeWatch *direct = tree_watch(tree, "/a/", false);
+    TreeWatch *recursive = tree_watch(tree, "/", true);
+    CHECK(direct != NULL && recursive != NULL);
+    CHECK(!ready(direct));
+    CHECK(tree_create(tree, "/b/") == 0);
+    CHECK(tree_create(tree, "/a/x/") == 0);
+    CHECK(ready(direct));
+    // Wnuk /a/ jest tylko w obserwacji rekurencyjnej.
+    CHECK(tree_create(tree, "/a/x/y/") == 0);
+    CHECK(tree_move(tree, "/a/x/", "/a/z/") == 0);
+    CHECK(tree_move(tree, "/a/z/", "/b/z/") == 0);
+    // Nieudane operacje nie są zgłaszane.
+    CHECK(tree_create(tree, "/a/") == EEXIST);
+    CHECK(tree_move(tree, "/a/x/", "/b/x/") == ENOENT);
+    CHECK(tree_remove(tree, "/b/z/y/") == 0);
+    CHECK(tree_remove(tree, "/b/z/") == 0);
+
+    uint64_t cookies[9], all[9];
+    const Expected in_a[] = {
+        {TREE_EVENT_CREATED, "/a/x/"},
+        {TREE_EVENT_MOVED_FROM, "/a/x/"},
+        {TREE_EVENT_MOVED_TO, "/a/z/"},
+        // Przeniesienie poza /a/ obserwacja /a/ widzi tylko z jednej strony.
+        {TREE_EVENT_MOVED_FROM, "/a/z/"},
+    };
+    expect(direct, in_a, 4, cookies);
+    CHECK(!ready(direct));
+    const Expected everywhere[] = {
+        {TREE_EVENT_CREATED, "/b/"},
+        {TREE_EVENT_CREATED, "/a/x/"},
+        {TREE_EVENT_CREATED, "/a/x/y/"},
+        {TREE_EVENT_MOVED_FROM, "/a/x/"},
+        {TREE_EVENT_MOVED_TO, "/a/z/"},
+        {TREE_EVENT_MOVED_FROM, "/a/z/"},
+        {TREE_EVENT_MOVED_TO, "/b/z/"},
+        {TREE_EVENT_REMOVED, "/b/z/y/"},
+        {TREE_EVENT_REMOVED, "/b/z/"},
+    };
+    expect(recursive, everywhere, 9, all);
+    // Zdarzenia przeniesienia mają wspólne cookie, różne dla różnych
+    // przeniesień i takie samo we wszystkich obserwacjach.
+    CHECK(all[3] != 0 && all[3] == all[4]);
+    CHECK(all[5] != 0 && all[5] == all[6] && all[5] != all[3]);
+    CHECK(cookies[1] == all[3] && cookies[2] == all[4]);
+    CHECK(cookies[3] == all[5]);
+    CHECK(cookies[0] == 0 && all[0] == 0 && all[7] == 0);
+    tree_watch_free(direct);
+    tree_watch_free(recursive);
+    tree_free(tree);
+}
+
+// Bufor obserwacji mieści 1024 zdarzenia.
+#define OVERFLOW_ROUNDS 600
+
+static void test_overflow(void) {
+    Tree *tree = tree_new();
+    CHECK(tree_create(tree, "/o/") == 0);
+    TreeWatch *watch = tree_watch(tree, "/o/", false);
+    for (int i = 0; i < OVERFLOW_ROUNDS; i++) {
+        CHECK(tree_create(tree, "/o/a/") == 0);
+        CHECK(tree_remove(tree, "/o/a/") == 0);
+    }
+    TreeEvent events[2 * OVERFLOW_ROUNDS];
+    size_t n = tree_watch_read(watch, events, 2 * OVERFLOW_ROUNDS, false);
+    // Najpierw wszystkie zdarzenia, które się zmieściły, a po nich jedno
+    // zgłoszenie przepełnienia z liczbą straconych.
+    CHECK(n > 1 && n < 2 * OVERFLOW_ROUNDS);
+    for (size_t i = 0; i + 1 < n; i++) {
+        CHECK(events[i].type ==
+              (i % 2 ? TREE_EVENT_REMOVED : TREE_EVENT_CREATED));
+        CHECK(strcmp(events[i].path, "/o/a/") == 0);
+        free(events[i].path);
+    }
+    CHECK(events[n - 1].type == TREE_EVENT_OVERFLOW);
+    CHECK(events[n - 1].path == NULL);
+    CHECK(events[n - 1].cookie == 2 * OVERFLOW_ROUNDS - (n - 1));
+    // Po opróżnieniu bufor znowu przyjmuje zdarzenia.
+    CHECK(tree_watch_read(watch, events, 1, false) == 0);
+    CHECK(tree_create(tree, "/o/b/") == 0);
+    CHECK(tree_watch_read(watch, events, 2, false) == 1);
+    CHECK(events[0].type == TREE_EVENT_CREATED);
+    CHECK(strcmp(events[0].path, "/o/b/") == 0);
+    free(events[0].path);
+    tree_watch_free(watch);
+    tree_free(tree);
+}
+
+#define PRODUCERS 4
+#define PRODUCED 20000
+
+typedef struct Producer {
+    Watches *watches;
+    uint64_t id;
+} Producer;
+
+// Zgłasza zdarzenia z cookie złożonym z numeru piszącego i kolejnego
+// numeru zdarzenia.
+static void *produce(void *arg) {
+    Producer *p = arg;
+    for (uint64_t i = 1; i <= PRODUCED; i++)
+        watches_post(p->watches, TREE_EVENT_CREATED, "/q/x/", p->id << 32 | i);
+    return NULL;
+}
+
+// Wielu piszących naraz z czytającym, który czeka na zdarzenia: każde
+// zdarzenie jest odebrane najwyżej raz, zdarzenia jednego piszącego
+// przychodzą w kolejności, a te, które się nie zmieściły, są policzone
+// w zgłoszeniach przepełnienia.
+static void test_concurrent_ring(void) {
+    Watches *watches = watches_new();
+    TreeWatch *watch = watch_new(watches, "/q/", false);
+    pthread_t threads[PRODUCERS];
+    Producer producers[PRODUCERS];
+    for (int i = 0; i < PRODUCERS; i++) {
+        producers[i] = (Producer) {watches, i};
+        CHECK(pthread_create(&threads[i], NULL, produce, &producers[i]) == 0);
+    }
+    uint64_t last[PRODUCERS] = {0};
+    size_t received = 0, lost = 0;
+    TreeEvent events[64];
+    while (received + lost < PRODUCERS * PRODUCED) {
+        size_t n = tree_watch_read(watch, events, 64, true);
+        CHECK(n > 0);
+        for (size_t i = 0; i < n; i++) {
+            if (events[i].type == TREE_EVENT_OVERFLOW) {
+                lost += events[i].cookie;
+                continue;
+            }
+            CHECK(strcmp(events[i].path, "/q/x/") == 0);
+            free(events[i].path);
+            uint64_t id = events[i].cookie >> 32;
+            uint64_t seq = events[i].cookie & 0xffffffff;
+            CHECK(id < PRODUCERS && seq > last[id] && seq <= PRODUCED);
+            last[id] = seq;
+            received++;
+        }
+    }
+    for (int i = 0; i < PRODUCERS; i++)
+        CHECK(pthread_join(threads[i], NULL) == 0);
+    CHECK(received + lost == PRODUCERS * PRODUCED);
+    CHECK(tree_watch_read(watch, events, 64, false) == 0);
+    tree_watch_free(watch);
+    watches_free(watches);
+}
+
+// watches_post bierze lock rejestru tylko dla ścieżek, dla których
+// watches_covered jest prawdą.
+static void test_covered(void) {
+    Watches *watches = watches_new();
+    CHECK(!watches_covered(watches, "/a/b/"));
+    TreeWatch *direct = watch_new(watches, "/a/", false);
+    TreeWatch *recursive = watch_new(watches, "/r/", true);
+    CHECK(watches_covered(watches, "/a/b/"));
+    CHECK(!watches_covered(watches, "/a/b/c/"));
+    CHECK(!watches_covered(watches, "/a/"));
+    CHECK(watches_covered(watches, "/r/x/"));
+    CHECK(watches_covered(watches, "/r/x/y/z/"));
+    CHECK(!watches_covered(watches, "/b/x/"));
+    CHECK(!watches_covered(watches, "/ra/x/"));
+    tree_watch_free(recursive);
+    CHECK(!watches_covered(watches, "/r/x/"));
+    tree_watch_free(direct);
+    CHECK(!watches_covered(watches, "/a/b/"));
+    watches_free(watches);
+}
+
+int main(void) {
+    test_sequence();
+    test_overflow();
+    test_concurrent_ring();
+    test_covered();
+    return 0;
+}